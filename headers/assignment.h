@@ -0,0 +1,18 @@
+#ifndef ASSIGNMENT_H
+#define ASSIGNMENT_H
+
+#include <stdint.h>
+
+// Min-cost assignment (Hungarian algorithm, O(rows^2 * cols)). Each row is matched to a
+// distinct column so that the summed cost is minimal; rows must not outnumber columns.
+// Forbidden pairs should be given ASSIGNMENT_INFEASIBLE, which the solver avoids whenever
+// another complete matching exists.
+
+#define ASSIGNMENT_INFEASIBLE ((int64_t)1 << 40)
+
+// Function to solve a rows x cols problem. cost is row-major (cost[r * cols + c]).
+// Fills row_to_col[r] with the column matched to row r. Returns 0, or -1 if rows > cols or
+// memory could not be allocated.
+int assignment_solve(int rows, int cols, const int64_t *cost, int *row_to_col);
+
+#endif // ASSIGNMENT_H
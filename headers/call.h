@@ -3,4 +3,7 @@
 
 void run_call(const char *source_floor, const char *destination_floor);
 
+// Function to run a persistent, pipelined call session reading calls from stdin
+void run_call_session(void);
+
 #endif // CALL_H
\ No newline at end of file
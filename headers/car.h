@@ -1,6 +1,18 @@
 #ifndef CAR_H
 #define CAR_H
 
-void run_car(const char *name, const char *lowest_floor, const char *highest_floor, int delay);
+#include "motion.h"
+
+// Optional behaviour selected on the command line; all off by default
+typedef struct {
+    int binary;        // Offer the binary protocol to the controller (--binary)
+    int heartbeat_ms;  // Heartbeat interval in ms, both ways, for liveness checks (--heartbeat-ms)
+    int shm;           // Offer a shared-memory link to a controller on the same host (--shm)
+    int itinerary;     // Ask the controller for the stops ahead and move on to each without waiting (--itinerary)
+    motion_profile motion; // Acceleration profile for travel (--motion; cruise_ms 0 = a fixed delay per floor)
+    int workers;       // Worker threads hosting the cars in fleet mode (--workers; 0 = default)
+} car_options;
+
+void run_car(const char *name, const char *lowest_floor, const char *highest_floor, int delay, const car_options *options);
 
 #endif // CAR_H
\ No newline at end of file
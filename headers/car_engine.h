@@ -0,0 +1,88 @@
+#ifndef CAR_ENGINE_H
+#define CAR_ENGINE_H
+
+#include "motion.h"
+#include "network.h"
+#include "shared_memory.h"
+#include "timer.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Door and travel timing of one car, shared by the single-car program and fleet mode. Each
+// phase (doors opening, doors held open, doors closing, travel to the next floor) ends at an
+// absolute deadline on the monotonic clock, kept in a timer while the phase can end by itself.
+// The next phase starts at that deadline rather than when the car got round to it, and every
+// floor of a trip is passed at the time the car's motion profile gives from the moment it set
+// off, so a trip takes exactly as long as the profile says however late each wakeup is. A status written by
+// another process, such as the safety system reopening obstructed doors, starts a fresh phase
+// of that status.
+typedef struct {
+    car_shared_mem *car_mem;        // Shared memory for car state
+    int lowest_level;               // Range of the car, as levels (see floor_to_level())
+    int highest_level;
+    int delay;                      // Length of every door phase in milliseconds
+    motion_profile motion;          // Travel time between floors
+    char status[STATUS_STR_SIZE];   // Status the running phase belongs to
+    uint64_t phase_end_ms;          // When the running phase ends
+    timer phase;                    // Expires at phase_end_ms while the phase is timed
+    timer_heap *timers;             // Heap the phase timer is scheduled in
+    int itinerary[ITINERARY_MAX_STOPS]; // Stops still to make, in order, as levels
+    int itinerary_len;              // Number of stops in itinerary (0 when following FLOOR)
+    int trip_origin;                // Level the current trip set off from
+    int trip_direction;             // Direction of the current trip (1 up, -1 down, 0 none)
+    int trip_destination;           // Level the travel phase was timed for
+    uint64_t trip_start_ms;         // When the current trip set off
+} car_engine;
+
+// The last state reported to the controller, used to send STATUS only on a transition
+typedef struct {
+    char status[STATUS_STR_SIZE];
+    char current_floor[FLOOR_STR_SIZE];
+    char destination_floor[FLOOR_STR_SIZE];
+    uint64_t sent_ms;               // When it was sent (for the idle heartbeat)
+} reported_state;
+
+// Function to put a new car's shared memory in its starting state: doors closed at the lowest
+// floor, no buttons pressed and normal service
+void car_state_init(car_shared_mem *car_mem, const char *lowest_floor);
+
+// Function to set up the engine of a car serving lowest_floor..highest_floor. Its phase timer
+// is scheduled in timers and carries owner as its data. With a NULL motion, every floor of
+// travel takes delay.
+void car_engine_init(car_engine *engine, car_shared_mem *car_mem, const char *lowest_floor, const char *highest_floor,
+                     int delay, const motion_profile *motion, timer_heap *timers, void *owner);
+
+// Function to apply button presses, mode changes and new destinations, then re-arm the phase
+// timer. Returns 1 if shared memory changed. Called with car_mem->mutex held.
+int car_engine_step(car_engine *engine, uint64_t now);
+
+// Function to finish the running phase once its timer has expired (and been popped) and start
+// the next one from its deadline. Called with car_mem->mutex held.
+void car_engine_expire(car_engine *engine);
+
+// Function to replace the car's itinerary with the stops (levels) of an ITINERARY message. The
+// first stop becomes the destination, unless it is the floor the doors are open at, which is
+// being served already. Called with car_mem->mutex held.
+void car_engine_set_itinerary(car_engine *engine, const int *levels, int count);
+
+// Function to parse "ITINERARY {version} {floor} ..." into levels. Returns the number of
+// stops, or -1 if the message is malformed.
+int parse_itinerary(const char *message, uint16_t *version, int *levels);
+
+// Function to apply a FLOOR from the controller to shared memory, waking the car. A FLOOR for
+// the floor the car is stopped at asks for its doors to be opened there. Called with
+// car_mem->mutex held.
+void car_apply_floor(car_shared_mem *car_mem, const char *floor);
+
+// Function to check whether shared memory differs from the last reported state.
+// Called with car_mem->mutex held.
+int state_changed(const car_shared_mem *car_mem, const reported_state *reported);
+
+// Function to record the state about to be reported. Called with car_mem->mutex held.
+void record_state(const car_shared_mem *car_mem, reported_state *reported);
+
+// Function to format the car's "STATUS {status} {current} {destination}" message.
+// Called with car_mem->mutex held.
+void format_status(const car_shared_mem *car_mem, char *message, size_t size);
+
+#endif // CAR_ENGINE_H
@@ -0,0 +1,27 @@
+#ifndef FLEET_H
+#define FLEET_H
+
+#include "car.h"
+
+// Fleet mode (car --fleet {spec}) hosts many cars in one process. Every car still has its own
+// /car{name} shared memory and its own session with the controller, exactly as if it ran on
+// its own, but all of them are driven by a small pool of worker threads: each worker owns a
+// share of the cars, waits for their sockets with epoll and for their door, travel, connection
+// and heartbeat deadlines with one timer heap. Changes made to a car's shared memory by other
+// programs (buttons, service modes, the safety system) are picked up within FLEET_POLL_MS.
+//
+// The spec is a comma-separated list of {name}:{lowest floor}:{highest floor}:{delay}[:{count}]
+// entries. With a count, the entry stands for count cars named {name}1 to {name}{count}, so
+// "A:1:20:100:250,B:B2:50:80:250" is 500 cars.
+
+#define FLEET_DEFAULT_WORKERS 2
+#define FLEET_MAX_WORKERS 64
+#define FLEET_MAX_CARS 10000
+#define FLEET_NAME_SIZE 64       // Longest car name, including its terminator
+#define FLEET_POLL_MS 10         // How often each car's shared memory is checked for outside changes
+
+// Function to run the cars described by spec until SIGINT. Returns 0, or -1 if the spec is
+// invalid or the cars could not be set up.
+int run_fleet(const char *spec, const car_options *options);
+
+#endif // FLEET_H
@@ -0,0 +1,25 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdint.h>
+
+// Travel time of a car along its shaft. A car sets off from rest, accelerates for accel_ms to
+// its cruising speed of one floor every cruise_ms, and brakes at the same rate to stop at its
+// destination; on a trip too short to reach cruising speed it starts braking half way. The car
+// passes the floors of a long run faster and faster, so an express run over n floors takes
+// n * cruise_ms + accel_ms rather than n delays. A profile with accel_ms 0 is the flat model:
+// every floor takes cruise_ms.
+
+typedef struct {
+    int cruise_ms;                   // Time per floor at cruising speed
+    int accel_ms;                    // Time to reach cruising speed from rest (0 = flat)
+} motion_profile;
+
+// Function to get the time (in ms) of a trip over floors floors, from rest to rest
+uint64_t motion_trip_ms(const motion_profile *profile, int floors);
+
+// Function to get the time (in ms) from setting off on a trip over floors floors until the
+// car reaches the passed'th floor of it (floors for the destination itself)
+uint64_t motion_pass_ms(const motion_profile *profile, int floors, int passed);
+
+#endif // MOTION_H
@@ -2,18 +2,160 @@
 #define NETWORK_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 // Networking constants
 #define CONTROLLER_IP "127.0.0.1"
 #define CONTROLLER_PORT 3000
+#define CONNECT_TIMEOUT_MS 1000  // Longest a connection attempt to the controller may take
 
-// Function to create a TCP connection to the controller
+// When set, clients reach the controller over this Unix domain socket instead of TCP.
+// A leading '@' selects the abstract namespace (no file is created).
+#define CONTROLLER_SOCKET_ENV "ELEVATOR_SOCKET"
+
+// Function to connect to the controller, over the Unix socket named by CONTROLLER_SOCKET_ENV
+// if it is set and over TCP otherwise. Gives up after CONNECT_TIMEOUT_MS.
 int connect_to_controller();
 
-// Function to send a length-prefixed message
+// Function to start connecting to the controller (chosen as for connect_to_controller()) on a
+// non-blocking socket. Returns the socket, or -1 on failure. *in_progress is set when the
+// connection is still being made: wait for the socket to become writable, then call
+// connect_result().
+int connect_to_controller_nonblocking(int *in_progress);
+
+// Function to get the outcome of a non-blocking connection attempt. Returns 0 if connected.
+int connect_result(int sockfd);
+
+// Function to fill in a Unix socket address for a path ('@' prefix = abstract namespace).
+// Returns 0, or -1 if the path is empty or too long.
+int unix_address(const char *path, struct sockaddr_un *addr, socklen_t *len);
+
+#define MAX_CORKED_FRAMES 8  // Most frames send_messages() writes in one call
+
+// Function to send a length-prefixed message (header and body in one system call)
 int send_message(int sockfd, const char *message);
 
-// Function to receive a length-prefixed message
-int receive_message(int sockfd, char **message);
+// Function to send several length-prefixed messages in one system call
+int send_messages(int sockfd, const char *const *messages, int count);
+
+// Function to disable Nagle's algorithm on a TCP socket
+void set_nodelay(int sockfd);
+
+#define MAX_FRAME_SIZE 512                        // Largest message body a frame may carry
+#define FRAME_READER_SIZE (4 * (MAX_FRAME_SIZE + 4))  // Receive buffer: several frames per read()
+
+// Buffered reader for length-prefixed frames. Each fill is a single read() of whatever the
+// socket has available, and every complete frame in the buffer is then handed out in place,
+// NUL-terminated, without copying or allocating.
+typedef struct {
+    char buf[FRAME_READER_SIZE + 1];  // Received bytes (+1 so the last frame can be terminated)
+    size_t start;                     // Offset of the first byte not yet handed out
+    size_t end;                       // Offset one past the last byte received
+    size_t held;                      // Offset of the byte under the current frame's terminator
+    char saved;                       // That byte's original value
+    int holding;                      // Whether a terminator needs to be undone
+} frame_reader;
+
+// Function to initialise an empty frame reader
+void frame_reader_init(frame_reader *r);
+
+// Function to read whatever the socket has available with one read(). Returns the number of
+// bytes read, 0 if the peer closed the connection, or -1 on error (including EAGAIN).
+ssize_t frame_reader_fill(frame_reader *r, int sockfd);
+
+// Function to append bytes received by other means. Returns how many fit; take the complete
+// frames out with frame_reader_next() before feeding the rest.
+size_t frame_reader_feed(frame_reader *r, const void *data, size_t len);
+
+// Function to take the next complete frame. *message points into the reader and stays valid
+// until the next call on the reader. Returns 1 with a frame, 0 if more data is needed, or -1
+// if the peer sent a frame larger than MAX_FRAME_SIZE.
+int frame_reader_next(frame_reader *r, char **message, size_t *len);
+
+// Optional binary car protocol. A car offers it by appending BINARY_PROTOCOL to its CAR
+// message; a controller that supports it answers "PROTOCOL BIN1", after which STATUS and FLOOR
+// travel as small fixed-size frames (still length-prefixed) instead of text. A binary frame
+// starts with a byte >= 0x80, which never begins a text message. Multi-byte fields are
+// big-endian, floors are signed floor numbers (B1 = -1, 1 = 1) and statuses are BIN_STATUS_*.
+#define BINARY_PROTOCOL "BIN1"
+#define BIN_STATUS_FRAME 0x81         // Car -> controller: type, status, seq(2), current(2), destination(2)
+#define BIN_FLOOR_FRAME 0x82          // Controller -> car: type, 0, seq(2), floor(2)
+#define BIN_STATUS_SIZE 8
+#define BIN_FLOOR_SIZE 6
+
+// Optional heartbeats. A car appends "HEARTBEAT <ms>" to its CAR message (after BIN1, if
+// offered) and then repeats its STATUS after that long without a change, while the controller
+// sends HEARTBEAT_MESSAGE at the same interval. Either side treats HEARTBEAT_MISSES intervals
+// without hearing anything from the other as a dead peer and drops the connection.
+#define HEARTBEAT_TOKEN "HEARTBEAT"
+#define HEARTBEAT_MESSAGE "ALIVE"
+#define HEARTBEAT_MISSES 3
+
+// Optional itineraries. A car appends ITINERARY_TOKEN to its CAR message; the controller then
+// sends "ITINERARY {version} {floor} {floor} ..." (the car's next stops in order, up to
+// ITINERARY_MAX_STOPS, always as text) in place of FLOOR. Each message replaces the previous
+// itinerary as a whole, and the car ignores one whose version (a 16-bit counter starting afresh
+// with every session) is not newer than the last it applied. The car makes the first stop its
+// destination, drops it once its doors open there, and sets off for the next as soon as the
+// doors have closed, without waiting to hear from the controller.
+#define ITINERARY_TOKEN "ITINERARY"
+#define ITINERARY_MAX_STOPS 8
+
+// Optional motion profile. A car that accelerates rather than taking its delay for every floor
+// appends "MOTION {cruise ms} {accel ms}" to its CAR message (see motion.h), so the controller
+// times its trips with the same profile. Door phases still take the car's delay.
+#define MOTION_TOKEN "MOTION"
+
+// Status codes, in the order a car normally passes through them at a stop
+enum { BIN_STATUS_CLOSED, BIN_STATUS_OPENING, BIN_STATUS_OPEN, BIN_STATUS_CLOSING, BIN_STATUS_BETWEEN, BIN_STATUS_COUNT };
+
+// Function to get the status code for a status string (-1 if unknown)
+int status_code(const char *status);
+
+// Function to get the status string for a status code (NULL if out of range)
+const char *status_name(int code);
+
+// Functions to build and parse binary STATUS frames. Decoding returns 0, or -1 if malformed.
+void encode_bin_status(unsigned char *frame, int status, uint16_t seq, int current, int destination);
+int decode_bin_status(const char *frame, size_t len, int *status, uint16_t *seq, int *current, int *destination);
+
+// Functions to build and parse binary FLOOR frames. Decoding returns 0, or -1 if malformed.
+void encode_bin_floor(unsigned char *frame, uint16_t seq, int floor);
+int decode_bin_floor(const char *frame, size_t len, uint16_t *seq, int *floor);
+
+// Function to send raw bytes as one length-prefixed frame
+int send_frame(int sockfd, const void *data, size_t len);
+
+#define TX_QUEUE_SIZE 4096  // Bytes of outbound frames a connection may have queued
+
+// Outbound length-prefixed frames waiting to be written to a non-blocking socket.
+// A frame pushed as superseding replaces the previous superseding frame if that one has
+// not started to go out, so a slow peer only receives the latest of them.
+typedef struct {
+    char buf[TX_QUEUE_SIZE];    // Queued frames
+    size_t len;                 // Bytes queued in buf
+    size_t sent;                // Bytes at the front of buf already written
+    size_t last_start;          // Offset of the most recent frame
+    int last_supersedes;        // Whether the most recent frame may be replaced
+} tx_queue;
+
+// Function to initialise an empty outbound queue
+void tx_queue_init(tx_queue *q);
+
+// Function to queue a message as a length-prefixed frame. Returns 0, or -1 if it does not fit.
+int tx_queue_push(tx_queue *q, const char *message, int supersede);
+
+// Function to queue raw bytes as a length-prefixed frame. Returns 0, or -1 if it does not fit.
+int tx_queue_push_frame(tx_queue *q, const void *data, size_t len, int supersede);
+
+// Function to write as much of the queue as the socket accepts without blocking.
+// Returns 0 when everything has been sent, 1 if data remains, or -1 on a socket error.
+int tx_queue_flush(tx_queue *q, int sockfd);
+
+// Function to check whether anything is waiting to be sent
+int tx_queue_empty(const tx_queue *q);
 
 #endif // NETWORK_H
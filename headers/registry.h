@@ -0,0 +1,60 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A registry is a growable table of fixed-size records addressed by generational handles.
+// Records live in chunks that are never moved or freed while the registry exists, so a
+// pointer to a record stays valid memory for the registry's lifetime; a removed slot is
+// recycled with a new generation, so stale handles are detected in O(1) instead of aliasing
+// whichever record reused the slot.
+
+#define REGISTRY_CHUNK_SLOTS 64      // Records per chunk
+#define REGISTRY_MAX_CHUNKS 1024     // Upper bound on chunks (65536 records)
+
+// Handle: generation in the upper 32 bits, slot index in the lower 32. 0 is never valid.
+typedef uint64_t registry_handle;
+
+#define REGISTRY_NO_HANDLE ((registry_handle)0)
+
+typedef struct registry_slot registry_slot;
+
+typedef struct {
+    size_t record_size;                          // Size of each record in bytes
+    size_t slot_size;                            // Size of slot header plus record, aligned
+    void (*construct)(void *record);             // Called once per record when its chunk is created
+    pthread_mutex_t mutex;                       // Protects allocation, release and growth
+    unsigned char *chunks[REGISTRY_MAX_CHUNKS];  // Chunk storage, published before use
+    uint32_t capacity;                           // Number of slots in all allocated chunks
+    uint32_t free_head;                          // First free slot index + 1 (0 = none)
+    uint32_t live;                               // Number of records currently allocated
+} registry;
+
+// Function to initialise a registry for records of the given size
+void registry_init(registry *reg, size_t record_size, void (*construct)(void *record));
+
+// Function to allocate a record, growing the registry if needed. Returns NULL when full.
+void *registry_alloc(registry *reg, registry_handle *handle);
+
+// Function to release a record; its handle (and any copies of it) become stale
+void registry_release(registry *reg, registry_handle handle);
+
+// Function to look up a record by handle. Returns NULL if the handle is stale.
+void *registry_get(registry *reg, registry_handle handle);
+
+// Function to check whether a handle still refers to a live record
+int registry_is_live(registry *reg, registry_handle handle);
+
+// Function to get the number of slots that may be occupied (for iteration)
+uint32_t registry_capacity(registry *reg);
+
+// Function to get the record in a slot for iteration. Returns NULL if the slot is free,
+// otherwise the record and its current handle.
+void *registry_slot_record(registry *reg, uint32_t index, registry_handle *handle);
+
+// Function to get the number of live records
+uint32_t registry_count(registry *reg);
+
+#endif // REGISTRY_H
@@ -0,0 +1,77 @@
+#ifndef SHM_LINK_H
+#define SHM_LINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared-memory transport between a car and a controller on the same host. The car creates a
+// segment holding two single-producer/single-consumer rings (STATUS towards the controller,
+// FLOOR towards the car) and offers SHM_LINK_PROTOCOL in its CAR message; a controller that can
+// map the segment answers "PROTOCOL SHM1" and from then on both sides exchange those messages
+// through the rings. The socket stays open so either side still sees the other one exit.
+//
+// Producers and consumers only touch the ring indices; a futex is used only when a consumer
+// has run out of messages and gone to sleep, so a busy link makes no system calls at all.
+
+#define SHM_LINK_PROTOCOL "SHM1"
+#define SHM_LINK_PREFIX "/link"      // Segment name is SHM_LINK_PREFIX followed by the car name
+#define SHM_RING_SLOTS 64            // Messages per ring (a power of two)
+#define SHM_MESSAGE_SIZE 60          // Largest message, including its terminator
+#define SHM_SPIN_POLLS 1000          // Times a consumer checks for a message before sleeping
+
+// One message slot (64 bytes, one cache line)
+typedef struct {
+    uint32_t len;                    // Message length, excluding the terminator
+    char data[SHM_MESSAGE_SIZE];     // NUL-terminated message
+} shm_message;
+
+// A single-producer/single-consumer ring. head and tail only ever increase (wrapping), and
+// live on separate cache lines so the two sides do not contend on them.
+typedef struct {
+    _Alignas(64) uint32_t head;      // Next slot the consumer reads (written by the consumer)
+    uint32_t waiting;                // Set while the consumer is about to sleep or asleep
+    _Alignas(64) uint32_t tail;      // Next slot the producer writes (written by the producer)
+    _Alignas(64) uint32_t wake_seq;  // Futex word, bumped to wake a sleeping consumer
+    _Alignas(64) shm_message slots[SHM_RING_SLOTS];
+} shm_ring;
+
+typedef struct {
+    uint32_t magic;                  // SHM_LINK_MAGIC once the segment is initialised
+    uint32_t closed;                 // Set by either side to end the session
+    shm_ring to_controller;          // Car -> controller (STATUS)
+    shm_ring to_car;                 // Controller -> car (FLOOR)
+} shm_link;
+
+#define SHM_LINK_MAGIC 0x4c4b5331u   // "LKS1"
+
+// Function to build a car's segment name. Returns 0, or -1 if it does not fit.
+int shm_link_name(const char *car_name, char *out, size_t size);
+
+// Function to create (replacing any stale segment) and map a link. Returns 0 or -1.
+int shm_link_create(const char *shm_name, shm_link **link);
+
+// Function to map an existing, initialised link. Returns 0, or -1 if it is missing or invalid.
+int shm_link_open(const char *shm_name, shm_link **link);
+
+// Function to unmap a link
+void shm_link_close(shm_link *link);
+
+// Function to remove a link's segment name
+void shm_link_unlink(const char *shm_name);
+
+// Function to end a session and wake the consumers of both rings
+void shm_link_shut(shm_link *link);
+
+// Function to append a message (producer only). Returns 0, or -1 if the ring is full, the
+// message is too long or the link is shut.
+int shm_ring_push(shm_link *link, shm_ring *ring, const char *message);
+
+// Function to take the next message (consumer only). Returns 1 with a message, 0 if empty.
+int shm_ring_pop(shm_ring *ring, char *message, size_t size);
+
+// Function to wait until the ring has a message (consumer only): checks SHM_SPIN_POLLS
+// times, then sleeps on the futex. Returns 1 when a message is ready, 0 on timeout, or -1
+// once the link is shut. timeout_ms -1 waits indefinitely.
+int shm_ring_wait(shm_link *link, shm_ring *ring, int timeout_ms);
+
+#endif // SHM_LINK_H
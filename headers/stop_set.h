@@ -0,0 +1,114 @@
+#ifndef STOP_SET_H
+#define STOP_SET_H
+
+#include <stdint.h>
+
+// Per-car set of pending stops, indexed by level (see floor_to_level()). Instead of a queue of
+// individual requests, each car keeps three bitmaps over its lowest..highest range:
+//   up   - hall calls from passengers waiting to travel up
+//   down - hall calls from passengers waiting to travel down
+//   car  - drop-offs for passengers already on board
+// Inserting and de-duplicating a stop is a single bit set, and the next stop in the direction
+// of travel is found with a bit scan, so the cost does not grow with the number of callers.
+// A call's drop-off is held back as a pending pair until its pickup is served, so the car
+// never visits a destination before the passenger has boarded. Pending pairs are indexed by
+// a hash on (pickup, drop-off) and chained per pickup level and direction, and the drop-offs
+// they plan are counted per level, so merging, withdrawing or boarding a call never scans the
+// other pending calls.
+
+#define STOP_SET_MAX_LEVELS 1152                 // B99..999 is 1098 levels, rounded up to 64
+#define STOP_SET_WORDS (STOP_SET_MAX_LEVELS / 64)
+#define STOP_NONE INT32_MIN                      // Returned when there is no next stop
+
+// Selectors for which bitmaps an operation looks at
+#define STOPS_UP   1
+#define STOPS_DOWN 2
+#define STOPS_CAR  4
+#define STOPS_ALL  (STOPS_UP | STOPS_DOWN | STOPS_CAR)
+#define STOPS_PLANNED 8                          // Drop-offs not yet active (never a stop by itself)
+
+// The bitmaps alone; small enough to copy into a car snapshot for ETA simulation
+typedef struct {
+    int32_t lowest;                  // Level of bit 0
+    int32_t levels;                  // Number of levels in range
+    uint64_t up[STOP_SET_WORDS];     // Hall calls going up
+    uint64_t down[STOP_SET_WORDS];   // Hall calls going down
+    uint64_t car[STOP_SET_WORDS];    // Drop-offs for passengers on board
+    uint64_t planned[STOP_SET_WORDS]; // Drop-offs for passengers still waiting to board
+} stop_bits;
+
+// A drop-off that becomes a car stop once its pickup is served
+typedef struct {
+    int32_t pickup;                  // Level of the pickup
+    int32_t direction;               // Direction the passenger travels (1 up, -1 down)
+    int32_t dest;                    // Level of the drop-off
+    int32_t callers;                 // Number of calls that share this pickup and drop-off
+    int32_t prev;                    // Neighbours among the pairs with the same pickup and
+    int32_t next;                    // direction (indices into pending, -1 at the ends)
+} pending_drop;
+
+typedef struct {
+    stop_bits bits;                  // Active stops
+    int32_t direction;               // Sweep direction: 1 up, -1 down, 0 idle
+    pending_drop *pending;           // Drop-offs waiting for their pickup
+    int32_t pending_count;           // Number of entries in pending
+    int32_t pending_capacity;        // Allocated entries in pending
+    int32_t *hash;                   // (pickup, drop-off) -> index + 1 into pending (0 = free)
+    int32_t hash_mask;               // Number of hash slots - 1 (twice pending_capacity)
+    int32_t *level_index;            // Per level: planned drop-offs there, then the first
+                                     // pending pair picking up there going up, then down
+} stop_set;
+
+// Function to initialise the bitmaps for a car serving lowest..highest (levels)
+void stop_bits_init(stop_bits *bits, int lowest, int highest);
+
+// Function to test whether any of the selected bitmaps has a stop at a level
+int stop_bits_test(const stop_bits *bits, int which, int level);
+
+// Function to count the stops in the selected bitmaps
+int stop_bits_count(const stop_bits *bits, int which);
+
+// Function to find the next stop for a car positioned at `position` sweeping in *direction
+// (LOOK order: keep going while there are stops ahead, then reverse). Updates *direction to
+// the direction of travel towards the returned stop. Returns STOP_NONE when there is nothing to do.
+int stop_bits_next(const stop_bits *bits, int position, int *direction);
+
+// Function to serve the stops at a level the car has opened its doors at, reversing the sweep
+// direction if nothing is left ahead. Returns the hall directions that boarded (STOPS_UP/DOWN).
+int stop_bits_arrive(stop_bits *bits, int level, int *direction);
+
+// Function to initialise an empty stop set for a car serving lowest..highest (levels)
+void stop_set_init(stop_set *set, int lowest, int highest);
+
+// Function to release memory held by a stop set
+void stop_set_free(stop_set *set);
+
+// Function to add a call from source to dest. Returns 0, or -1 if outside the car's range.
+int stop_set_add_call(stop_set *set, int source, int dest);
+
+// Function to withdraw a call whose pickup has not been served yet (for reassignment to another
+// car). The hall stop is kept while other calls still wait there. Returns 0, or -1 if the call
+// is not pending (its passengers may already have boarded).
+int stop_set_remove_call(stop_set *set, int source, int dest);
+
+// Function to check whether a call from source to dest is still waiting for its pickup
+int stop_set_is_pending(const stop_set *set, int source, int dest);
+
+// Function to detach the drop-offs still waiting for their pickups (for handing to another car).
+// Stores the array (owned by the caller, who must free it) in *out and returns its length.
+int stop_set_take_pending(stop_set *set, pending_drop **out);
+
+// Function to serve a level the car opened its doors at: clears its stops and turns the
+// drop-offs of passengers who boarded there into car stops
+void stop_set_arrive(stop_set *set, int level);
+
+// Function to find the next stop for a car at `position` (see stop_bits_next)
+int stop_set_next(stop_set *set, int position);
+
+// Function to plan the order a car at `position` would serve its stops in if no more calls
+// arrived: the stop stop_set_next() would pick, then the ones after it, with drop-offs joining
+// as their pickups are served. Leaves the set untouched. Stores up to max levels in out and
+// returns how many were stored.
+int stop_set_plan(const stop_set *set, int position, int *out, int max);
+
+#endif // STOP_SET_H
@@ -0,0 +1,56 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Timers keyed on absolute CLOCK_MONOTONIC deadlines (see monotonic_ms()). A timer is embedded
+// in whatever it times and scheduled in a binary min-heap, so finding the earliest deadline
+// is O(1), and scheduling, moving or cancelling a timer is O(log n) however many are pending.
+// A periodic timer is rescheduled from its previous deadline rather than from the time it was
+// handled, so lateness in waking up never accumulates from one period to the next.
+
+#define TIMER_IDLE SIZE_MAX              // heap_index of a timer that is not scheduled
+
+typedef struct {
+    uint64_t deadline_ms;            // Absolute monotonic time the timer expires at
+    size_t heap_index;               // Position in its heap, or TIMER_IDLE
+    void *data;                      // Owner of the timer, for whoever handles it
+} timer;
+
+typedef struct {
+    timer **entries;                 // Scheduled timers, earliest deadline at entries[0]
+    size_t count;                    // Number of scheduled timers
+    size_t capacity;                 // Allocated entries
+} timer_heap;
+
+// Function to initialise an unscheduled timer belonging to data
+void timer_init(timer *t, void *data);
+
+// Function to check whether a timer is scheduled
+int timer_pending(const timer *t);
+
+// Function to initialise an empty heap
+void timer_heap_init(timer_heap *heap);
+
+// Function to release memory held by a heap (its timers are left as they are)
+void timer_heap_free(timer_heap *heap);
+
+// Function to schedule a timer at deadline_ms, moving it if it is already scheduled.
+// Returns 0, or -1 if the heap could not grow.
+int timer_schedule(timer_heap *heap, timer *t, uint64_t deadline_ms);
+
+// Function to unschedule a timer (no-op if it is not scheduled)
+void timer_cancel(timer_heap *heap, timer *t);
+
+// Function to get the earliest deadline, or 0 if no timer is scheduled
+uint64_t timer_next_deadline(const timer_heap *heap);
+
+// Function to unschedule and return the earliest timer if it has expired by now, or NULL
+timer *timer_pop_expired(timer_heap *heap, uint64_t now);
+
+// Function to get how long to sleep from now until the earliest deadline, in milliseconds,
+// for poll-style timeouts: 0 if it has passed, -1 if no timer is scheduled
+int timer_timeout_ms(const timer_heap *heap, uint64_t now);
+
+#endif // TIMER_H
@@ -0,0 +1,73 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+// A minimal io_uring wrapper over the raw system calls (no liburing). One thread owns a ring:
+// it fills submission entries, submits them in one io_uring_enter() together with waiting for
+// completions, then walks the completions in place.
+
+typedef struct {
+    int fd;                          // Ring file descriptor (-1 when not set up)
+    unsigned *sq_head;               // Shared submission ring indices
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;              // Indirection from ring slots to sqes
+    struct io_uring_sqe *sqes;       // Submission entries
+    unsigned sq_pending;             // Entries filled in since the last submit
+    unsigned *cq_head;               // Shared completion ring indices
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;       // Completion entries
+    void *ring_mem;                  // Mapping holding both rings (IORING_FEAT_SINGLE_MMAP)
+    size_t ring_size;
+    size_t sqes_size;
+} uring;
+
+// A provided buffer ring: fixed-size receive buffers the kernel picks from for each recv
+typedef struct {
+    struct io_uring_buf_ring *ring;  // Shared ring of buffer descriptors
+    unsigned entries;                // Number of buffers (a power of two)
+    uint16_t group;                  // Buffer group ID used in IOSQE_BUFFER_SELECT requests
+    size_t buf_size;                 // Size of each buffer
+    unsigned char *memory;           // The buffers themselves
+} uring_buffers;
+
+// Function to set up a ring with room for `entries` submissions. Returns 0, or -1 (errno set)
+// if io_uring is unavailable or the kernel lacks a required feature.
+int uring_init(uring *ring, unsigned entries);
+
+// Function to tear down a ring
+void uring_free(uring *ring);
+
+// Function to get a zeroed submission entry, submitting what is queued first if the ring is
+// full. Returns NULL only if the kernel refuses the submission.
+struct io_uring_sqe *uring_get_sqe(uring *ring);
+
+// Function to submit the queued entries and wait until at least one completion is available,
+// or timeout_ms passes (-1 waits indefinitely, 0 does not wait). Returns 0 or -errno.
+int uring_submit_and_wait(uring *ring, int timeout_ms);
+
+// Function to get the next completion, or NULL if there are none
+struct io_uring_cqe *uring_peek_cqe(uring *ring);
+
+// Function to hand the completion returned by uring_peek_cqe() back to the kernel
+void uring_cqe_seen(uring *ring);
+
+// Function to allocate and register `entries` buffers of buf_size bytes as buffer group
+// `group`. Returns 0, or -1 on failure.
+int uring_buffers_init(uring *ring, uring_buffers *bufs, uint16_t group, unsigned entries, size_t buf_size);
+
+// Function to unregister and free a buffer group
+void uring_buffers_free(uring *ring, uring_buffers *bufs);
+
+// Function to get the memory of buffer `id` (from a completion's IORING_CQE_F_BUFFER flags)
+void *uring_buffer(uring_buffers *bufs, unsigned id);
+
+// Function to return buffer `id` to the kernel once its contents have been consumed
+void uring_buffer_recycle(uring_buffers *bufs, unsigned id);
+
+#endif // URING_H
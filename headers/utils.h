@@ -2,6 +2,8 @@
 #define UTILS_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
 // Function to validate floor strings
 int is_valid_floor(const char *floor);
@@ -12,9 +14,29 @@ int is_valid_status(const char *status);
 // Function to sleep for the specified number of milliseconds
 void sleep_ms(int milliseconds);
 
+// Function to sleep until the monotonic clock reaches deadline_ms (see monotonic_ms()). Loops
+// that wait for fixed periods should advance a deadline by the period and sleep until it, so
+// the time spent waking up is not added to every period.
+void sleep_until_ms(uint64_t deadline_ms);
+
+// Function to read the monotonic clock in milliseconds
+uint64_t monotonic_ms(void);
+
+// Function to convert a time in milliseconds (such as a monotonic deadline) to a timespec
+void ms_to_timespec(uint64_t ms, struct timespec *ts);
+
 // Function to set up signal handling
 void setup_signal_handler(void (*handler)(int));
 
+// Functions to convert between floor strings and signed integers (B1 = -1, 1 = 1)
+int floor_to_int(const char *floor);
+void int_to_floor(int floor_int, char *floor_str);
+
+// Functions to convert between floor strings and levels, a gap-free numbering where
+// adjacent floors differ by one (B1 = -1, 1 = 0, 2 = 1)
+int floor_to_level(const char *floor);
+void level_to_floor(int level, char *floor_str);
+
 // Function to compare floors
 int compare_floors(const char *floor1, const char *floor2);
 
@@ -0,0 +1,80 @@
+// assignment.c
+
+#include "assignment.h"
+#include <stdlib.h>
+
+int assignment_solve(int rows, int cols, const int64_t *cost, int *row_to_col) {
+    if (rows > cols) {
+        return -1;
+    }
+    if (rows == 0) {
+        return 0;
+    }
+
+    // Potentials u (rows) and v (columns), 1-based with column 0 as the virtual start
+    int64_t *u = calloc(rows + 1, sizeof(int64_t));
+    int64_t *v = calloc(cols + 1, sizeof(int64_t));
+    int64_t *min_slack = malloc((cols + 1) * sizeof(int64_t));
+    int *match = calloc(cols + 1, sizeof(int));   // Row matched to each column (0 = none)
+    int *way = calloc(cols + 1, sizeof(int));     // Previous column on the augmenting path
+    char *used = malloc(cols + 1);
+    if (!u || !v || !min_slack || !match || !way || !used) {
+        free(u); free(v); free(min_slack); free(match); free(way); free(used);
+        return -1;
+    }
+
+    for (int r = 1; r <= rows; ++r) {
+        // Grow a shortest augmenting path from row r, adjusting potentials as we go
+        match[0] = r;
+        int col = 0;
+        for (int c = 0; c <= cols; ++c) {
+            min_slack[c] = INT64_MAX;
+            used[c] = 0;
+        }
+        do {
+            used[col] = 1;
+            int row = match[col];
+            int64_t delta = INT64_MAX;
+            int next = 0;
+            for (int c = 1; c <= cols; ++c) {
+                if (used[c]) {
+                    continue;
+                }
+                int64_t slack = cost[(size_t)(row - 1) * cols + (c - 1)] - u[row] - v[c];
+                if (slack < min_slack[c]) {
+                    min_slack[c] = slack;
+                    way[c] = col;
+                }
+                if (min_slack[c] < delta) {
+                    delta = min_slack[c];
+                    next = c;
+                }
+            }
+            for (int c = 0; c <= cols; ++c) {
+                if (used[c]) {
+                    u[match[c]] += delta;
+                    v[c] -= delta;
+                } else {
+                    min_slack[c] -= delta;
+                }
+            }
+            col = next;
+        } while (match[col] != 0);
+
+        // Flip the matching along the path
+        do {
+            int prev = way[col];
+            match[col] = match[prev];
+            col = prev;
+        } while (col != 0);
+    }
+
+    for (int c = 1; c <= cols; ++c) {
+        if (match[c] != 0) {
+            row_to_col[match[c] - 1] = c - 1;
+        }
+    }
+
+    free(u); free(v); free(min_slack); free(match); free(way); free(used);
+    return 0;
+}
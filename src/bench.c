@@ -0,0 +1,359 @@
+#include "../headers/network.h"  // Include the framing helpers and connect_to_controller()
+#include "../headers/utils.h"    // Include monotonic_ms()
+#include <stdio.h>               // Standard I/O library for the report
+#include <stdlib.h>              // Standard library for memory management and atoi()
+#include <string.h>              // String functions for parsing replies
+#include <unistd.h>              // UNIX standard functions (close(), usleep())
+#include <errno.h>               // Error numbers (EINTR from interrupted reads)
+#include <time.h>                // clock_gettime() for call latencies
+#include <signal.h>              // Ignore SIGPIPE if the controller goes away
+#include <dirent.h>              // Walk the controller's threads for context switch counts
+#include <sys/epoll.h>           // epoll to drive thousands of simulated connections
+#include <sys/resource.h>        // Raise the open file limit
+
+// Load generator for comparing the controller's event loop backends (epoll and --io-uring).
+// It connects thousands of simulated cars that report a new STATUS every few milliseconds and
+// drain the FLOOR frames sent to them, plus a few pipelined call sessions that keep a window of
+// calls in flight. It reports call throughput and latency and, given the controller's PID, the
+// controller's CPU time, read/write system calls and context switches over the run.
+
+#define BENCH_LOWEST 1                // Floors the simulated cars serve
+#define BENCH_HIGHEST 50
+#define MAX_WINDOW 64                 // Largest number of calls in flight per session
+#define CONNECT_ATTEMPTS 5            // A full accept queue drops SYNs, so retry connects
+
+typedef enum { BENCH_CAR, BENCH_CALLER } bench_kind;
+
+// One simulated connection
+typedef struct {
+    int sockfd;                       // Connection to the controller
+    bench_kind kind;                  // Car or call session
+    frame_reader rx;                  // Received bytes not yet consumed
+    int floor;                        // Car: floor it last reported
+    unsigned int next_id;             // Caller: request ID of the next call
+    int outstanding;                  // Caller: calls sent but not yet answered
+    struct timespec sent[MAX_WINDOW]; // Caller: send time of each call in flight, by ID
+} bench_conn;
+
+// Controller counters sampled before and after the run
+typedef struct {
+    long user_ms;                     // CPU time in user mode
+    long sys_ms;                      // CPU time in the kernel
+    long long reads;                  // read-type system calls (syscr)
+    long long writes;                 // write-type system calls (syscw)
+    long long switches;               // Voluntary and involuntary context switches, all threads
+} proc_sample;
+
+static long long calls_done = 0;      // Replies received
+static long long calls_unavailable = 0; // Replies that were UNAVAILABLE
+static double latency_total_us = 0;   // Sum of call round trips
+static long long status_sent = 0;     // STATUS frames sent by the cars
+static long long floors_received = 0; // FLOOR frames received by the cars
+static long long send_failures = 0;   // Frames that could not be sent
+
+// Function to get the microseconds between two times
+static double elapsed_us(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1e6 + (to->tv_nsec - from->tv_nsec) / 1e3;
+}
+
+// Function to read the controller's counters from /proc. Returns 0, or -1 if unavailable.
+static int sample_process(int pid, proc_sample *sample) {
+    char path[64];
+    char line[512];
+    memset(sample, 0, sizeof(*sample));
+
+    // utime and stime are fields 14 and 15 of /proc/{pid}/stat, after the parenthesised name
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    unsigned long utime = 0, stime = 0;
+    if (fgets(line, sizeof(line), f)) {
+        char *rest = strrchr(line, ')');
+        if (rest) {
+            sscanf(rest + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+        }
+    }
+    fclose(f);
+    long ticks = sysconf(_SC_CLK_TCK);
+    sample->user_ms = utime * 1000 / ticks;
+    sample->sys_ms = stime * 1000 / ticks;
+
+    snprintf(path, sizeof(path), "/proc/%d/io", pid);
+    f = fopen(path, "r");
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            sscanf(line, "syscr: %lld", &sample->reads);
+            sscanf(line, "syscw: %lld", &sample->writes);
+        }
+        fclose(f);
+    }
+
+    // Context switches are per thread
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR *tasks = opendir(path);
+    if (tasks) {
+        struct dirent *entry;
+        while ((entry = readdir(tasks)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            char status_path[300];
+            snprintf(status_path, sizeof(status_path), "/proc/%d/task/%s/status", pid, entry->d_name);
+            f = fopen(status_path, "r");
+            if (!f) {
+                continue;
+            }
+            while (fgets(line, sizeof(line), f)) {
+                long long count;
+                if (sscanf(line, "voluntary_ctxt_switches: %lld", &count) == 1 ||
+                    sscanf(line, "nonvoluntary_ctxt_switches: %lld", &count) == 1) {
+                    sample->switches += count;
+                }
+            }
+            fclose(f);
+        }
+        closedir(tasks);
+    }
+    return 0;
+}
+
+// Function to send one frame, counting failures. Sockets stay blocking so a frame is never
+// left half written; the controller never stops reading for long.
+static void bench_send(bench_conn *conn, const char *message) {
+    if (send_message(conn->sockfd, message) != 0) {
+        send_failures++;
+    }
+}
+
+// Function to send a caller's next call between two random floors
+static void send_call(bench_conn *conn) {
+    char message[64];
+    int source = BENCH_LOWEST + rand() % (BENCH_HIGHEST - BENCH_LOWEST + 1);
+    int dest = BENCH_LOWEST + rand() % (BENCH_HIGHEST - BENCH_LOWEST);
+    if (dest >= source) {
+        dest++;  // Never the same floor
+    }
+    unsigned int id = conn->next_id++;
+    snprintf(message, sizeof(message), "CALL %u %d %d", id, source, dest);
+    clock_gettime(CLOCK_MONOTONIC, &conn->sent[id % MAX_WINDOW]);
+    conn->outstanding++;
+    bench_send(conn, message);
+}
+
+// Function to move a car to a neighbouring floor and report it
+static void send_status(bench_conn *conn) {
+    char message[64];
+    int step = (rand() & 1) ? 1 : -1;
+    if (conn->floor + step < BENCH_LOWEST || conn->floor + step > BENCH_HIGHEST) {
+        step = -step;
+    }
+    int from = conn->floor;
+    conn->floor += step;
+    snprintf(message, sizeof(message), "STATUS Between %d %d", from, conn->floor);
+    bench_send(conn, message);
+    status_sent++;
+}
+
+// Function to consume what a readable connection has received, with one read (epoll reports
+// it again if more is left), topping up a caller's window. Returns -1 if it closed.
+static int drain(bench_conn *conn, int window) {
+    ssize_t n = frame_reader_fill(&conn->rx, conn->sockfd);
+    if (n == 0) {
+        return -1;
+    }
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    char *message;
+    size_t len;
+    while (frame_reader_next(&conn->rx, &message, &len) == 1) {
+        if (conn->kind == BENCH_CAR) {
+            floors_received++;  // FLOOR frames; the car does not act on them
+            continue;
+        }
+
+        // "CAR {id} {name}" or "UNAVAILABLE {id}"
+        unsigned int id;
+        if (sscanf(message, "CAR %u", &id) != 1) {
+            if (sscanf(message, "UNAVAILABLE %u", &id) != 1) {
+                continue;
+            }
+            calls_unavailable++;
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        latency_total_us += elapsed_us(&conn->sent[id % MAX_WINDOW], &now);
+        calls_done++;
+        conn->outstanding--;
+        if (conn->outstanding < window) {
+            send_call(conn);
+        }
+    }
+    return 0;
+}
+
+// Function to connect a simulated connection and register it with the epoll instance
+static int open_bench_conn(bench_conn *conn, int epoll_fd, bench_kind kind, int index) {
+    conn->sockfd = connect_to_controller();
+    for (int attempt = 1; conn->sockfd == -1 && attempt < CONNECT_ATTEMPTS; ++attempt) {
+        usleep(10000);  // Let the controller drain its accept queue
+        conn->sockfd = connect_to_controller();
+    }
+    if (conn->sockfd == -1) {
+        return -1;
+    }
+    conn->kind = kind;
+    frame_reader_init(&conn->rx);
+
+    if (kind == BENCH_CAR) {
+        char car_message[64];
+        char status_message[64];
+        conn->floor = BENCH_LOWEST + index % (BENCH_HIGHEST - BENCH_LOWEST + 1);
+        snprintf(car_message, sizeof(car_message), "CAR Bench%d %d %d", index, BENCH_LOWEST, BENCH_HIGHEST);
+        snprintf(status_message, sizeof(status_message), "STATUS Closed %d %d", conn->floor, conn->floor);
+        const char *handshake[2] = { car_message, status_message };
+        if (send_messages(conn->sockfd, handshake, 2) != 0) {
+            close(conn->sockfd);
+            return -1;
+        }
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->sockfd, &ev);
+}
+
+int main(int argc, char *argv[]) {
+    int callers = 8;      // Pipelined call sessions
+    int window = 16;      // Calls in flight per session
+    int status_ms = 100;  // Interval between each car's STATUS reports
+    int pid = 0;          // Controller to sample, if given
+
+    // Options may follow the two required arguments
+    for (int i = 3; i < argc; ++i) {
+        if (strcmp(argv[i], "--callers") == 0 && i + 1 < argc) {
+            callers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            window = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--status-ms") == 0 && i + 1 < argc) {
+            status_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--pid") == 0 && i + 1 < argc) {
+            pid = atoi(argv[++i]);
+        } else {
+            argc = 0;  // Unknown option: fall through to the usage message
+        }
+    }
+    if (argc < 3 || atoi(argv[1]) <= 0 || atoi(argv[2]) <= 0 || callers < 1 || window < 1 ||
+        window > MAX_WINDOW || status_ms < 1) {
+        fprintf(stderr, "Usage: %s {cars} {seconds} [--callers {n}] [--window {1-%d}] [--status-ms {ms}] [--pid {controller pid}]\n",
+                argv[0], MAX_WINDOW);
+        return EXIT_FAILURE;
+    }
+    int cars = atoi(argv[1]);
+    int seconds = atoi(argv[2]);
+
+    // Every simulated connection is a file descriptor here and in the controller
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    srand(1);  // Same load on every run
+
+    int epoll_fd = epoll_create1(0);
+    int total = cars + callers;
+    bench_conn *conns = calloc(total, sizeof(bench_conn));
+    if (epoll_fd == -1 || !conns) {
+        perror("setup");
+        return EXIT_FAILURE;
+    }
+
+    // Connect the cars first so every call has the whole fleet to choose from
+    uint64_t connect_start = monotonic_ms();
+    for (int i = 0; i < total; ++i) {
+        if (open_bench_conn(&conns[i], epoll_fd, i < cars ? BENCH_CAR : BENCH_CALLER, i) != 0) {
+            fprintf(stderr, "Connection %d failed (is the controller running?)\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+    uint64_t connect_ms = monotonic_ms() - connect_start;
+
+    proc_sample before, after;
+    int sampled = pid > 0 && sample_process(pid, &before) == 0;
+
+    // Fill every caller's window, then keep it full until the time is up
+    struct timespec run_start, run_end;
+    clock_gettime(CLOCK_MONOTONIC, &run_start);
+    for (int i = cars; i < total; ++i) {
+        for (int w = 0; w < window; ++w) {
+            send_call(&conns[i]);
+        }
+    }
+
+    uint64_t start_ms = monotonic_ms();
+    uint64_t end_ms = start_ms + (uint64_t)seconds * 1000;
+    uint64_t next_status_ms = start_ms + status_ms;
+    struct epoll_event events[256];
+    int lost = 0;
+    for (;;) {
+        uint64_t now = monotonic_ms();
+        if (now >= end_ms) {
+            break;
+        }
+
+        // Each tick, every car reports a move
+        if (now >= next_status_ms) {
+            for (int i = 0; i < cars; ++i) {
+                send_status(&conns[i]);
+            }
+            next_status_ms += status_ms;
+            continue;
+        }
+
+        uint64_t wake = next_status_ms < end_ms ? next_status_ms : end_ms;
+        int n = epoll_wait(epoll_fd, events, 256, (int)(wake - now));
+        for (int i = 0; i < n; ++i) {
+            bench_conn *conn = (bench_conn *)events[i].data.ptr;
+            if (drain(conn, window) != 0) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->sockfd, NULL);
+                lost++;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &run_end);
+    if (sampled) {
+        sample_process(pid, &after);
+    }
+
+    double run_s = elapsed_us(&run_start, &run_end) / 1e6;
+    printf("cars %d, call sessions %d x %d in flight, STATUS every %d ms per car\n", cars, callers, window, status_ms);
+    printf("connect        %llu ms for %d connections\n", (unsigned long long)connect_ms, total);
+    printf("calls          %lld in %.2f s = %.0f calls/s (%lld unavailable)\n",
+           calls_done, run_s, calls_done / run_s, calls_unavailable);
+    printf("call latency   %.0f us mean\n", calls_done ? latency_total_us / calls_done : 0.0);
+    printf("car traffic    %lld STATUS sent (%.0f/s), %lld FLOOR received\n", status_sent, status_sent / run_s, floors_received);
+    if (send_failures || lost) {
+        printf("errors         %lld sends failed, %d connections lost\n", send_failures, lost);
+    }
+    if (sampled) {
+        long long frames = calls_done + status_sent;  // Frames the controller received
+        printf("controller     user %ld ms, sys %ld ms\n", after.user_ms - before.user_ms, after.sys_ms - before.sys_ms);
+        // sendmsg() and io_uring completions are not counted in /proc/{pid}/io
+        printf("               read syscalls %lld (%.2f per received frame), write syscalls %lld\n",
+               after.reads - before.reads, frames ? (double)(after.reads - before.reads) / frames : 0.0,
+               after.writes - before.writes);
+        printf("               context switches %lld\n", after.switches - before.switches);
+    }
+
+    for (int i = 0; i < total; ++i) {
+        close(conns[i].sockfd);
+    }
+    free(conns);
+    close(epoll_fd);
+    return EXIT_SUCCESS;
+}
@@ -5,12 +5,16 @@
 #include <stdlib.h>              // Standard library for memory management, exit codes
 #include <string.h>              // String library for comparing/manipulating strings
 #include <unistd.h>              // UNIX standard library for closing sockets, among other things
+#include <poll.h>                // poll() to wait on stdin and the controller at the same time
 
 // Function to handle making a call request to the elevator system
 void run_call(const char *source_floor, const char *destination_floor) {
     int sockfd;                 // Socket file descriptor for the network connection
     char message[256];          // Buffer for the message we'll send to the controller
-    char *response = NULL;      // Pointer to hold the response from the controller
+    static frame_reader reader; // Buffer the reply is received into (bounded by MAX_FRAME_SIZE)
+    char *response = NULL;      // Points at the reply inside reader
+    size_t response_len;        // Length of the reply
+    int status;                 // Result of frame_reader_next()
 
     // Check if both the source and destination floors are valid
     if (!is_valid_floor(source_floor) || !is_valid_floor(destination_floor)) {
@@ -41,8 +45,14 @@ void run_call(const char *source_floor, const char *destination_floor) {
         return;
     }
 
-    // Receive the response from the controller
-    if (receive_message(sockfd, &response) != 0) {  // Check if receiving failed
+    // Receive the response from the controller, reading until one whole frame has arrived
+    frame_reader_init(&reader);
+    while ((status = frame_reader_next(&reader, &response, &response_len)) == 0) {
+        if (frame_reader_fill(&reader, sockfd) <= 0) {
+            break;  // Connection closed or failed before the reply was complete
+        }
+    }
+    if (status != 1) {  // Check if receiving failed (or the reply was oversized)
         printf("Unable to connect to elevator system.\n");
         close(sockfd);  // Close the socket
         return;
@@ -59,16 +69,198 @@ void run_call(const char *source_floor, const char *destination_floor) {
         printf("Unexpected response from elevator system.\n");
     }
 
-    // Clean up: free the response memory and close the socket
-    free(response);
+    // Clean up: close the socket (the reply lives in the reader, so there is nothing to free)
+    close(sockfd);
+}
+
+#define MAX_SESSION_CALLS 1024  // Maximum number of calls in flight on one session (a power of two)
+
+// Structure remembering a call sent on a session until its reply arrives. Slots are reused
+// once answered; the tag of a slot is its index plus a multiple of MAX_SESSION_CALLS that
+// grows with every reuse (wrapping at 32 bits), so a late reply for an earlier call in the
+// same slot (a --reassign update) is never taken for the call now using it.
+typedef struct {
+    char source_floor[4];       // Source floor of the call
+    char destination_floor[4];  // Destination floor of the call
+    unsigned int tag;           // Request ID of the call in this slot
+    int pending;                // 1 while waiting for the controller's reply
+} session_call;
+
+// Function to print the reply to a tagged call in the same wording as run_call
+static void print_session_reply(const session_call *call, unsigned int id, const char *reply) {
+    char car_name[32];
+    printf("[%u] %s -> %s: ", id, call->source_floor, call->destination_floor);
+    if (sscanf(reply, "CAR %*u %31s", car_name) == 1) {
+        printf("Car %s is arriving.\n", car_name);
+    } else {
+        printf("Sorry, no car is available to take this request.\n");
+    }
+    fflush(stdout);
+}
+
+// Function to run a persistent call session: reads "{source} {destination}" lines from stdin,
+// pipelines them to the controller over a single connection as tagged CALL requests and prints
+// each reply as soon as it arrives (replies may come back in any order)
+void run_call_session(void) {
+    static session_call calls[MAX_SESSION_CALLS];
+    static int free_slots[MAX_SESSION_CALLS];  // Stack of slots not waiting for a reply
+    static frame_reader reader; // Replies received but not yet printed
+    int free_count = 0;         // Number of entries in free_slots
+    int outstanding = 0;        // Requests sent but not yet answered
+    int input_open = 1;         // 0 once stdin reaches end of file
+    char line[256];             // Partially read input line(s)
+    size_t line_len = 0;        // Number of bytes in line
+    int skipping = 0;           // 1 while discarding the rest of an over-long line
+    char message[256];
+
+    int sockfd = connect_to_controller();
+    if (sockfd == -1) {
+        printf("Unable to connect to elevator system.\n");
+        return;
+    }
+    frame_reader_init(&reader);
+    for (int i = MAX_SESSION_CALLS - 1; i >= 0; --i) {
+        calls[i].tag = (unsigned int)i - MAX_SESSION_CALLS;  // The first use moves it to i
+        calls[i].pending = 0;
+        free_slots[free_count++] = i;
+    }
+
+    while (input_open || outstanding > 0) {
+        struct pollfd fds[2];
+        fds[0].fd = sockfd;
+        fds[0].events = POLLIN;
+        // Stop reading new calls while every slot is waiting for a reply (a closed or
+        // finished stdin is left out altogether, as poll() would keep reporting its hangup)
+        fds[1].fd = (input_open && outstanding < MAX_SESSION_CALLS) ? STDIN_FILENO : -1;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+
+        if (poll(fds, 2, -1) < 0) {
+            break;
+        }
+
+        // Print replies from the controller as they arrive
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            char *response;
+            size_t len;
+            unsigned int id;
+            int status;
+            if (frame_reader_fill(&reader, sockfd) <= 0) {
+                printf("Unable to connect to elevator system.\n");
+                break;
+            }
+            while ((status = frame_reader_next(&reader, &response, &len)) == 1) {
+                int is_car = sscanf(response, "CAR %u", &id) == 1;
+                if (!is_car && sscanf(response, "UNAVAILABLE %u", &id) != 1) {
+                    printf("Unexpected response from elevator system.\n");
+                    continue;
+                }
+                session_call *call = &calls[id % MAX_SESSION_CALLS];
+                if (call->tag != id) {
+                    continue;  // A --reassign update for a call whose slot has since been reused
+                }
+                if (call->pending) {
+                    call->pending = 0;
+                    outstanding--;
+                    free_slots[free_count++] = (int)(id % MAX_SESSION_CALLS);
+                    print_session_reply(call, id, response);
+                } else if (is_car) {
+                    // A controller running with --reassign moved an answered call to another car
+                    print_session_reply(call, id, response);
+                }
+            }
+            if (status < 0) {
+                printf("Unexpected response from elevator system.\n");
+                break;
+            }
+        }
+
+        // Read more input; stdin is read with read() so buffered lines never hide from poll()
+        if (fds[1].revents & (POLLIN | POLLHUP)) {
+            ssize_t n = read(STDIN_FILENO, line + line_len, sizeof(line) - 1 - line_len);
+            if (n <= 0) {
+                input_open = 0;
+                if (line_len == 0 || skipping) {
+                    line_len = 0;
+                    continue;
+                }
+                line[line_len++] = '\n';  // Treat a final unterminated line as complete
+            } else {
+                line_len += n;
+            }
+            if (skipping) {
+                // Discard up to the end of the over-long line
+                char *end = memchr(line, '\n', line_len);
+                size_t consumed = end ? (size_t)(end - line) + 1 : line_len;
+                memmove(line, line + consumed, line_len - consumed);
+                line_len -= consumed;
+                skipping = end == NULL;
+            }
+        }
+
+        // Send each complete line as a call as soon as it is read
+        char *end;
+        while (outstanding < MAX_SESSION_CALLS && (end = memchr(line, '\n', line_len)) != NULL) {
+            *end = '\0';
+            char source_floor[8], destination_floor[8];
+            int valid = sscanf(line, "%7s %7s", source_floor, destination_floor) == 2;
+
+            size_t consumed = (size_t)(end - line) + 1;
+            memmove(line, line + consumed, line_len - consumed);
+            line_len -= consumed;
+
+            if (!valid) {
+                continue;  // Skip blank or incomplete lines
+            }
+            if (!is_valid_floor(source_floor) || !is_valid_floor(destination_floor)) {
+                printf("Invalid floor(s) specified.\n");
+                continue;
+            }
+            if (strcmp(source_floor, destination_floor) == 0) {
+                printf("You are already on that floor!\n");
+                continue;
+            }
+
+            session_call *call = &calls[free_slots[--free_count]];
+            call->tag += MAX_SESSION_CALLS;
+            strcpy(call->source_floor, source_floor);
+            strcpy(call->destination_floor, destination_floor);
+            call->pending = 1;
+
+            snprintf(message, sizeof(message), "CALL %u %s %s", call->tag, source_floor, destination_floor);
+            if (send_message(sockfd, message) != 0) {
+                printf("Unable to connect to elevator system.\n");
+                input_open = 0;
+                outstanding = 0;
+                break;
+            }
+            outstanding++;
+        }
+
+        // A full buffer without a newline holds a line too long to be a call; reject it and
+        // skip the rest of it, so the next read always has room
+        if (line_len == sizeof(line) - 1 && memchr(line, '\n', line_len) == NULL) {
+            printf("Call too long, skipping it.\n");
+            line_len = 0;
+            skipping = 1;
+        }
+    }
+
     close(sockfd);
 }
 
 // Main function to handle command-line input and call the run_call function
 int main(int argc, char *argv[]) {
+    // "--session" keeps one connection open and reads calls from stdin
+    if (argc == 2 && strcmp(argv[1], "--session") == 0) {
+        run_call_session();
+        return EXIT_SUCCESS;
+    }
+
     // Check if the user provided the correct number of arguments (source and destination floors)
     if (argc != 3) {
         fprintf(stderr, "Usage: %s {source floor} {destination floor}\n", argv[0]);
+        fprintf(stderr, "       %s --session < calls\n", argv[0]);
         return EXIT_FAILURE;  // Exit with an error code if the arguments are incorrect
     }
 
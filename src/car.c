@@ -1,7 +1,10 @@
 #include "shared_memory.h"  // Include functions for managing shared memory
 #include "network.h"        // Include functions for network communication
+#include "shm_link.h"       // Include the shared-memory rings used with a controller on this host
 #include "utils.h"          // Include utility functions, such as time-related functions
+#include "car_engine.h"     // Include the door and travel state machine
 #include "car.h"            // Include car-specific functions and definitions
+#include "fleet.h"          // Include fleet mode, which hosts many cars in one process
 #include <stdio.h>          // Standard I/O library
 #include <stdlib.h>         // Standard library for memory allocation, conversion, and process control
 #include <string.h>         // String manipulation functions
@@ -10,13 +13,17 @@
 #include <signal.h>         // Signal handling for interrupts
 #include <errno.h>          // Error number definitions
 #include <time.h>           // Time-related functions
-#include <sys/select.h>     // For monitoring multiple file descriptors
-#include <sys/time.h>       // Time value structures
+#include <sys/socket.h>     // shutdown() to stop a connection's receiver
+#include <sys/time.h>       // Time value structures (receive timeout)
+
+// Upper bound on the wait between connection attempts (unless the car's delay is longer)
+#define RECONNECT_MAX_BACKOFF_MS 2000
 
 // A global flag that determines if the program should keep running
 static volatile sig_atomic_t keep_running = 1;
 
-// Signal handler to stop the program on receiving a specific signal (e.g., SIGINT)
+// Signal handler to stop the program on receiving a specific signal (e.g., SIGINT). Only used
+// until run_car() blocks SIGINT and hands it to its signal thread.
 static void int_handler(int dummy) {
     (void)dummy;  // Avoid unused parameter warning
     keep_running = 0;  // Set the flag to stop the loop in other threads
@@ -29,123 +36,416 @@ typedef struct {
     car_shared_mem *car_mem;    // Pointer to shared memory for car state
     const char *lowest_floor;   // Lowest floor the car can access
     const char *highest_floor;  // Highest floor the car can access
+    int binary;                 // Offer the binary protocol in the CAR message
+    int heartbeat_ms;           // Heartbeat interval negotiated with the controller (0 = none)
+    int shm;                    // Offer a shared-memory link in the CAR message
+    int itinerary;              // Ask the controller for itineraries in the CAR message
+    const motion_profile *motion; // Acceleration profile announced in the CAR message (NULL if none)
+    car_engine *engine;         // State machine that follows the itinerary
 } controller_args_t;
 
-// Function that handles the communication between the car and the controller
+// State shared between the status sender and the receivers of one controller connection.
+// binary_active, shm_active and closed are written by the receiver with car_mem->mutex held.
+typedef struct {
+    int sockfd;                 // Connection to the controller
+    car_shared_mem *car_mem;    // Shared memory for car state
+    int offered_binary;         // The CAR message offered the binary protocol
+    int binary_active;          // Set once the controller has accepted the binary protocol
+    shm_link *shm;              // Shared-memory link offered in the CAR message (NULL if none)
+    char shm_name[280];         // Name of the link's segment
+    pthread_t shm_tid;          // Receiver for FLOOR messages arriving on the link
+    int shm_active;             // Set once the controller has accepted the link
+    int closed;                 // Set when the connection has failed or been closed
+    car_engine *engine;         // State machine that follows the itinerary
+    int itinerary_seen;         // Whether an ITINERARY has arrived on this connection
+    uint16_t itinerary_version; // Version of the newest ITINERARY applied
+} controller_link;
+
+// Function to apply an ITINERARY from the controller unless a newer one has been applied
+// already (one sent on the socket can be overtaken by one sent on the shared-memory link).
+// Called with car_mem->mutex held.
+static void apply_itinerary(controller_link *link, const char *message) {
+    int levels[ITINERARY_MAX_STOPS];
+    uint16_t version;
+    int count = parse_itinerary(message, &version, levels);
+    if (count < 0 || (link->itinerary_seen && (int16_t)(version - link->itinerary_version) <= 0)) {
+        return;
+    }
+    link->itinerary_seen = 1;
+    link->itinerary_version = version;
+    car_engine_set_itinerary(link->engine, levels, count);
+}
+
+// Function that receives messages from the controller for one connection. Each FLOOR is written
+// to shared memory, which also wakes the status sender; a closed connection is flagged the same way.
+static void *receiver_thread(void *arg) {
+    controller_link *link = (controller_link *)arg;
+    car_shared_mem *car_mem = link->car_mem;
+    frame_reader reader;  // Buffered messages received from the controller
+    int status = 0;
+
+    frame_reader_init(&reader);
+    while (status >= 0) {
+        ssize_t n = frame_reader_fill(&reader, link->sockfd);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;  // Controller closed the connection or went silent, or the sender shut it down
+        }
+
+        // Act on each complete message in what was read
+        char *response;
+        size_t len;
+        while ((status = frame_reader_next(&reader, &response, &len)) == 1) {
+            int floor;
+            uint16_t seq;
+            if (decode_bin_floor(response, len, &seq, &floor) == 0) {
+                // Binary FLOOR: convert the floor number back to its string form
+                char floor_str[FLOOR_STR_SIZE];
+                int_to_floor(floor, floor_str);
+                pthread_mutex_lock(&car_mem->mutex);
+                car_apply_floor(car_mem, floor_str);
+                pthread_mutex_unlock(&car_mem->mutex);
+            } else if (link->offered_binary && strcmp(response, "PROTOCOL " BINARY_PROTOCOL) == 0) {
+                // The controller understands binary frames from now on
+                pthread_mutex_lock(&car_mem->mutex);
+                link->binary_active = 1;
+                pthread_mutex_unlock(&car_mem->mutex);
+            } else if (link->shm && strcmp(response, "PROTOCOL " SHM_LINK_PROTOCOL) == 0) {
+                // The controller has mapped the link: the sender moves STATUS onto it
+                pthread_mutex_lock(&car_mem->mutex);
+                link->shm_active = 1;
+                pthread_cond_broadcast(&car_mem->cond);
+                pthread_mutex_unlock(&car_mem->mutex);
+            } else if (strncmp(response, "FLOOR ", 6) == 0) {
+                // Process the response if it starts with "FLOOR"
+                pthread_mutex_lock(&car_mem->mutex);
+                car_apply_floor(car_mem, response + 6);  // Update the destination floor in shared memory
+                pthread_mutex_unlock(&car_mem->mutex);
+            } else if (strncmp(response, ITINERARY_TOKEN " ", sizeof(ITINERARY_TOKEN)) == 0) {
+                // The stops to make from here, replacing any earlier itinerary
+                pthread_mutex_lock(&car_mem->mutex);
+                apply_itinerary(link, response);
+                pthread_mutex_unlock(&car_mem->mutex);
+            }
+        }
+        // status < 0 is an oversized frame: the stream can no longer be trusted
+    }
+
+    // Wake the sender so it reconnects
+    pthread_mutex_lock(&car_mem->mutex);
+    link->closed = 1;
+    pthread_cond_broadcast(&car_mem->cond);
+    pthread_mutex_unlock(&car_mem->mutex);
+    return NULL;
+}
+
+// Function that receives FLOOR and ITINERARY messages from the controller over the shared-memory link. It
+// sleeps on the ring's futex while there is nothing to do and exits when the link is shut.
+static void *shm_receiver_thread(void *arg) {
+    controller_link *link = (controller_link *)arg;
+    car_shared_mem *car_mem = link->car_mem;
+    shm_ring *ring = &link->shm->to_car;
+    char message[SHM_MESSAGE_SIZE];
+
+    while (shm_ring_wait(link->shm, ring, -1) == 1) {
+        while (shm_ring_pop(ring, message, sizeof(message)) == 1) {
+            if (strncmp(message, "FLOOR ", 6) == 0) {
+                pthread_mutex_lock(&car_mem->mutex);
+                car_apply_floor(car_mem, message + 6);
+                pthread_mutex_unlock(&car_mem->mutex);
+            } else if (strncmp(message, ITINERARY_TOKEN " ", sizeof(ITINERARY_TOKEN)) == 0) {
+                pthread_mutex_lock(&car_mem->mutex);
+                apply_itinerary(link, message);
+                pthread_mutex_unlock(&car_mem->mutex);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Function to create the shared-memory link offered with the next connection and start its
+// receiver. Leaves link->shm NULL (so the link is not offered) if either step fails.
+static void open_shm_link(controller_link *link, const char *name) {
+    link->shm = NULL;
+    link->shm_active = 0;
+    if (shm_link_name(name, link->shm_name, sizeof(link->shm_name)) != 0 ||
+        shm_link_create(link->shm_name, &link->shm) != 0) {
+        link->shm = NULL;
+        return;
+    }
+    if (pthread_create(&link->shm_tid, NULL, shm_receiver_thread, link) != 0) {
+        shm_link_close(link->shm);
+        shm_link_unlink(link->shm_name);
+        link->shm = NULL;
+    }
+}
+
+// Function to shut a connection's shared-memory link (if any), wait for its receiver and
+// remove the segment
+static void close_shm_link(controller_link *link) {
+    if (!link->shm) {
+        return;
+    }
+    shm_link_shut(link->shm);
+    pthread_join(link->shm_tid, NULL);
+    shm_link_close(link->shm);
+    shm_link_unlink(link->shm_name);
+    link->shm = NULL;
+}
+
+// Function to connect to the controller and introduce the car with its CAR and first STATUS
+// messages. Records the reported state and returns the socket, or -1 if either step fails.
+static int connect_and_introduce(controller_args_t *args, int offer_shm, reported_state *reported) {
+    car_shared_mem *car_mem = args->car_mem;
+    char message[512];
+    char status_message[128];
+
+    int sockfd = connect_to_controller();  // Establish a connection to the controller
+    if (sockfd == -1) {
+        return -1;
+    }
+
+    // With heartbeats, a controller that has been silent for HEARTBEAT_MISSES intervals is
+    // presumed hung: the receiver's read times out and the car reconnects
+    if (args->heartbeat_ms > 0) {
+        int timeout_ms = HEARTBEAT_MISSES * args->heartbeat_ms;
+        struct timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+
+    // Send the CAR message, providing car details and any protocol extensions, together with
+    // the car's status so both reach the controller in a single segment
+    int length = snprintf(message, sizeof(message), "CAR %s %s %s%s%s%s", args->name, args->lowest_floor, args->highest_floor,
+                          args->binary ? " " BINARY_PROTOCOL : "", offer_shm ? " " SHM_LINK_PROTOCOL : "",
+                          args->itinerary ? " " ITINERARY_TOKEN : "");
+    if (args->motion) {
+        length += snprintf(message + length, sizeof(message) - length, " " MOTION_TOKEN " %d %d",
+                           args->motion->cruise_ms, args->motion->accel_ms);
+    }
+    if (args->heartbeat_ms > 0) {
+        snprintf(message + length, sizeof(message) - length, " " HEARTBEAT_TOKEN " %d", args->heartbeat_ms);
+    }
+    pthread_mutex_lock(&car_mem->mutex);
+    format_status(car_mem, status_message, sizeof(status_message));
+    record_state(car_mem, reported);
+    pthread_mutex_unlock(&car_mem->mutex);
+
+    const char *handshake[2] = { message, status_message };
+    if (send_messages(sockfd, handshake, 2) != 0) {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+// Function to close a connection: wakes the receivers out of their waits, waits for them, then
+// closes the socket and removes the link's segment
+static void disconnect(controller_link *link, pthread_t receiver_tid) {
+    shutdown(link->sockfd, SHUT_RDWR);
+    pthread_join(receiver_tid, NULL);
+    close_shm_link(link);
+    close(link->sockfd);
+}
+
+// Function to wait on the shared memory condition variable until it is signalled or the
+// monotonic clock reaches deadline_ms. Called with car_mem->mutex held.
+static void wait_until(car_shared_mem *car_mem, uint64_t deadline_ms) {
+    struct timespec deadline;
+    ms_to_timespec(deadline_ms, &deadline);
+    pthread_cond_timedwait(&car_mem->cond, &car_mem->mutex, &deadline);
+}
+
+// Function to pick how long to wait before the next connection attempt. The window starts at
+// the car's delay and doubles after every failure up to RECONNECT_MAX_BACKOFF_MS; the wait is
+// drawn from the window's upper half so cars that lost the controller together spread out.
+static int next_backoff(int *window_ms, int delay, unsigned int *seed) {
+    int window = *window_ms;
+    int wait = window / 2 + rand_r(seed) % (window / 2 + 1);
+    int limit = delay > RECONNECT_MAX_BACKOFF_MS ? delay : RECONNECT_MAX_BACKOFF_MS;
+    *window_ms = window > limit / 2 ? limit : window * 2;
+    return wait;
+}
+
+// Function that reports the car's status to the controller. Rather than polling, it sleeps on
+// the shared memory condition variable and sends STATUS as soon as the status or either floor
+// changes (and, with a heartbeat configured, repeats it after that long without a change).
+// Messages from the controller are handled by a receiver thread for each connection.
 void *controller_thread(void *arg) {
     controller_args_t *args = (controller_args_t *)arg;  // Cast the argument to the expected type
-    int sockfd = -1;  // File descriptor for the socket connection
-    char message[512];  // Buffer for messages to be sent to the controller
     car_shared_mem *car_mem = args->car_mem;  // Shared memory for car state
-    int delay = args->delay;  // Delay for communication
-    char *name = args->name;  // Name of the car
+    int delay = args->delay;  // Shortest delay between connection attempts
+    controller_link link;     // The current connection, if connected
+    pthread_t receiver_tid;   // Receiver thread for the current connection
+    int connected = 0;        // Whether link and receiver_tid are in use
+    int on_link = 0;          // Whether STATUS has moved onto the shared-memory link
+    int announced = 0;        // Whether the controller has been told the car left normal service
+    reported_state reported;  // What the controller was last told
+    uint16_t tx_seq = 0;      // Sequence number of the last binary STATUS sent
+    uint64_t retry_at = 0;    // Earliest time for the next connection attempt
+    int backoff_ms = delay;   // Current backoff window (see next_backoff)
+    unsigned int seed = (unsigned int)getpid() ^ (unsigned int)monotonic_ms();  // Jitter source
 
     // Ignore SIGPIPE to prevent crashes on broken pipes (when writing to a disconnected socket)
     signal(SIGPIPE, SIG_IGN);
 
+    pthread_mutex_lock(&car_mem->mutex);
     while (keep_running) {  // Main loop that runs until interrupted
-        // Lock the shared memory before accessing it
-        pthread_mutex_lock(&car_mem->mutex);
         int in_special_mode = car_mem->individual_service_mode || car_mem->emergency_mode;
-        pthread_mutex_unlock(&car_mem->mutex);
 
-        // If the car is in special mode, skip the network communication
-        if (in_special_mode) {
-            if (sockfd != -1) {
-                close(sockfd);  // Close the socket if connected
-                sockfd = -1;    // Mark the socket as closed
+        // Drop the connection when it fails, or when the car returns to normal service after
+        // announcing that it had left (the session then starts over with a CAR message)
+        if (connected && (link.closed || (announced && !in_special_mode))) {
+            if (link.closed && !in_special_mode) {
+                // Lost the controller: every car noticed at once, so reconnect at a random
+                // point within one delay rather than all together
+                retry_at = monotonic_ms() + rand_r(&seed) % (delay + 1);
+            }
+            pthread_mutex_unlock(&car_mem->mutex);
+            disconnect(&link, receiver_tid);
+            connected = 0;
+            pthread_mutex_lock(&car_mem->mutex);
+            if (args->itinerary) {
+                // The car finishes its current trip; the next controller sends a fresh itinerary
+                car_engine_set_itinerary(args->engine, NULL, 0);
             }
-            sleep_ms(delay);  // Sleep for the specified delay
             continue;
         }
 
-        // Attempt to connect to the controller if not already connected
-        if (sockfd == -1) {
-            sockfd = connect_to_controller();  // Establish a connection to the controller
-            if (sockfd != -1) {
-                // Send the initial CAR message to the controller, providing car details
-                snprintf(message, sizeof(message), "CAR %s %s %s", name, args->lowest_floor, args->highest_floor);
-                if (send_message(sockfd, message) != 0) {  // If sending the message fails
-                    close(sockfd);  // Close the socket
-                    sockfd = -1;    // Mark the socket as closed
-                    sleep_ms(delay);
-                    continue;
-                }
-
-                // Send the car's status to the controller
-                pthread_mutex_lock(&car_mem->mutex);
-                snprintf(message, sizeof(message), "STATUS %s %s %s", car_mem->status, car_mem->current_floor, car_mem->destination_floor);
+        // If the car is in special mode, tell the controller once (so it stops dispatching to
+        // the car) and then skip the network communication until the mode changes
+        if (in_special_mode) {
+            if (connected && !announced) {
+                const char *notice = car_mem->emergency_mode ? "EMERGENCY" : "INDIVIDUAL SERVICE";
+                announced = 1;
                 pthread_mutex_unlock(&car_mem->mutex);
-                if (send_message(sockfd, message) != 0) {
-                    close(sockfd);
-                    sockfd = -1;
-                    sleep_ms(delay);
-                    continue;
+                int sent = send_message(link.sockfd, notice);
+                pthread_mutex_lock(&car_mem->mutex);
+                if (sent != 0) {
+                    link.closed = 1;
                 }
-            } else {
-                // If the connection fails, sleep for the delay period and try again
-                sleep_ms(delay);
                 continue;
             }
-        }
-
-        // Send the car's status to the controller
-        pthread_mutex_lock(&car_mem->mutex);
-        snprintf(message, sizeof(message), "STATUS %s %s %s", car_mem->status, car_mem->current_floor, car_mem->destination_floor);
-        pthread_mutex_unlock(&car_mem->mutex);
-        if (send_message(sockfd, message) != 0) {
-            close(sockfd);
-            sockfd = -1;
-            sleep_ms(delay);
+            pthread_cond_wait(&car_mem->cond, &car_mem->mutex);
             continue;
         }
 
-        // Use select() to check if there is any message from the controller without blocking
-        fd_set read_fds;
-        struct timeval timeout;
-        FD_ZERO(&read_fds);  // Clear the set of file descriptors
-        FD_SET(sockfd, &read_fds);  // Add the socket file descriptor to the set
-        timeout.tv_sec = 0;  // Set timeout to 0 seconds
-        timeout.tv_usec = 0;  // Set timeout to 0 microseconds
-
-        int activity = select(sockfd + 1, &read_fds, NULL, NULL, &timeout);  // Monitor the socket for activity
-
-        if (activity > 0 && FD_ISSET(sockfd, &read_fds)) {  // If there's activity on the socket
-            char *response = NULL;
-            if (receive_message(sockfd, &response) != 0) {  // If receiving a message fails
-                close(sockfd);
-                sockfd = -1;
-                free(response);
+        // Attempt to connect to the controller if not already connected, backing off while it
+        // is unreachable (waking early if the car changes mode or shuts down)
+        if (!connected) {
+            uint64_t now = monotonic_ms();
+            if (now < retry_at) {
+                wait_until(car_mem, retry_at);
                 continue;
             }
+            pthread_mutex_unlock(&car_mem->mutex);
+            link.car_mem = car_mem;
+            link.shm = NULL;
+            link.engine = args->engine;
+            link.itinerary_seen = 0;  // Versions start afresh with every session
+            if (args->shm) {
+                open_shm_link(&link, args->name);  // Only a controller on this host can map it
+            }
+            int sockfd = connect_and_introduce(args, link.shm != NULL, &reported);
+            if (sockfd == -1) {
+                close_shm_link(&link);
+                retry_at = monotonic_ms() + next_backoff(&backoff_ms, delay, &seed);
+            } else {
+                backoff_ms = delay;  // Connected: the next outage starts from a short window
+                link.sockfd = sockfd;
+                link.offered_binary = args->binary;
+                link.binary_active = 0;  // Text until the controller accepts the offer
+                link.closed = 0;
+                on_link = 0;
+                announced = 0;
+                if (pthread_create(&receiver_tid, NULL, receiver_thread, &link) == 0) {
+                    connected = 1;
+                } else {
+                    close_shm_link(&link);
+                    close(sockfd);
+                    retry_at = monotonic_ms() + delay;
+                }
+            }
+            pthread_mutex_lock(&car_mem->mutex);
+            continue;
+        }
 
-            // Process the response if it starts with "FLOOR"
-            if (strncmp(response, "FLOOR ", 6) == 0) {
-                pthread_mutex_lock(&car_mem->mutex);
-                // Update the destination floor in shared memory
-                snprintf(car_mem->destination_floor, FLOOR_STR_SIZE, "%.*s", FLOOR_STR_SIZE - 1, response + 6);
-                pthread_cond_broadcast(&car_mem->cond);  // Notify other threads waiting on this condition
+        // Send the car's status whenever it has changed, or as a heartbeat when idle. Once the
+        // controller accepts the shared-memory link, the status is repeated there straight away,
+        // as it ignores any STATUS still in flight on the socket.
+        uint64_t now = monotonic_ms();
+        int heartbeat_due = args->heartbeat_ms > 0 && now - reported.sent_ms >= (uint64_t)args->heartbeat_ms;
+        int switching = link.shm_active && !on_link;
+        if (state_changed(car_mem, &reported) || heartbeat_due || switching) {
+            int sent;
+            record_state(car_mem, &reported);
+            if (link.shm_active) {
+                char message[SHM_MESSAGE_SIZE];
+                format_status(car_mem, message, sizeof(message));
                 pthread_mutex_unlock(&car_mem->mutex);
+                on_link = 1;
+                sent = shm_ring_push(link.shm, &link.shm->to_controller, message);  // Fails if the controller stopped reading
+            } else if (link.binary_active) {
+                unsigned char frame[BIN_STATUS_SIZE];
+                encode_bin_status(frame, status_code(car_mem->status), ++tx_seq,
+                                  floor_to_int(car_mem->current_floor), floor_to_int(car_mem->destination_floor));
+                pthread_mutex_unlock(&car_mem->mutex);
+                sent = send_frame(link.sockfd, frame, sizeof(frame));
+            } else {
+                char message[128];
+                format_status(car_mem, message, sizeof(message));
+                pthread_mutex_unlock(&car_mem->mutex);
+                sent = send_message(link.sockfd, message);
             }
-
-            free(response);  // Free the memory allocated for the response
+            pthread_mutex_lock(&car_mem->mutex);
+            if (sent != 0) {
+                link.closed = 1;
+            }
+            continue;
         }
 
-        sleep_ms(10);  // Sleep for a short period before checking again
+        // Nothing to report: sleep until shared memory changes (or the heartbeat is due)
+        if (args->heartbeat_ms > 0) {
+            wait_until(car_mem, reported.sent_ms + args->heartbeat_ms);
+        } else {
+            pthread_cond_wait(&car_mem->cond, &car_mem->mutex);
+        }
     }
+    pthread_mutex_unlock(&car_mem->mutex);
 
-    // Clean up: close the socket if it was open
-    if (sockfd != -1) {
-        close(sockfd);
+    // Clean up: close the connection if it was open
+    if (connected) {
+        disconnect(&link, receiver_tid);
     }
     pthread_exit(NULL);  // Exit the thread
 }
 
+// Function that turns SIGINT into a shutdown request. The signal is blocked in every thread and
+// taken here, so threads asleep on the condition variable are woken rather than left waiting.
+static void *signal_thread(void *arg) {
+    car_shared_mem *car_mem = (car_shared_mem *)arg;
+    sigset_t signals;
+    int sig;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    while (sigwait(&signals, &sig) != 0) {
+    }
+
+    pthread_mutex_lock(&car_mem->mutex);
+    keep_running = 0;
+    pthread_cond_broadcast(&car_mem->cond);
+    pthread_mutex_unlock(&car_mem->mutex);
+    return NULL;
+}
+
 // Main function that runs the car operations
-void run_car(const char *name, const char *lowest_floor, const char *highest_floor, int delay) {
+void run_car(const char *name, const char *lowest_floor, const char *highest_floor, int delay, const car_options *options) {
     char shm_name[256];  // Shared memory name for the car
     car_shared_mem *car_mem;  // Pointer to shared memory for car state
     pthread_t controller_tid;  // Thread for communicating with the controller
+    pthread_t signal_tid;      // Thread waiting for SIGINT
 
     // Format the shared memory name based on the car's name
     if (snprintf(shm_name, sizeof(shm_name), "/car%s", name) >= (int)sizeof(shm_name)) {
@@ -159,25 +459,17 @@ void run_car(const char *name, const char *lowest_floor, const char *highest_flo
         exit(EXIT_FAILURE);
     }
 
-    // Lock the shared memory and set initial car values
-    pthread_mutex_lock(&car_mem->mutex);
-    snprintf(car_mem->current_floor, FLOOR_STR_SIZE, "%.*s", FLOOR_STR_SIZE - 1, lowest_floor);
-    snprintf(car_mem->destination_floor, FLOOR_STR_SIZE, "%.*s", FLOOR_STR_SIZE - 1, lowest_floor);
-    snprintf(car_mem->status, STATUS_STR_SIZE, "Closed");
-
-    // Set initial values for buttons and flags
-    car_mem->open_button = 0;
-    car_mem->close_button = 0;
-    car_mem->door_obstruction = 0;
-    car_mem->overload = 0;
-    car_mem->emergency_stop = 0;
-    car_mem->individual_service_mode = 0;
-    car_mem->emergency_mode = 0;
-    pthread_mutex_unlock(&car_mem->mutex);
+    // Set initial car values: doors closed at the lowest floor, nothing pressed
+    car_state_init(car_mem, lowest_floor);
 
-    // Ignore SIGPIPE and set the signal handler for SIGINT
+    // Ignore SIGPIPE, and take SIGINT on a thread of its own (before any other thread starts,
+    // so they all inherit the blocked signal)
     signal(SIGPIPE, SIG_IGN);
-    signal(SIGINT, int_handler);
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    pthread_create(&signal_tid, NULL, signal_thread, car_mem);
 
     // Set up arguments for the controller thread
     controller_args_t ctrl_args;
@@ -187,50 +479,97 @@ void run_car(const char *name, const char *lowest_floor, const char *highest_flo
     ctrl_args.car_mem = car_mem;
     ctrl_args.lowest_floor = lowest_floor;
     ctrl_args.highest_floor = highest_floor;
+    ctrl_args.binary = options->binary;
+    ctrl_args.heartbeat_ms = options->heartbeat_ms;
+    ctrl_args.shm = options->shm;
+    ctrl_args.itinerary = options->itinerary;
+    ctrl_args.motion = options->motion.cruise_ms > 0 ? &options->motion : NULL;
+
+    // Set up the door and travel state machine, which the controller thread hands itineraries to
+    timer_heap timers;
+    timer_heap_init(&timers);
+    car_engine engine;
+    car_engine_init(&engine, car_mem, lowest_floor, highest_floor, delay, ctrl_args.motion, &timers, &engine);
+    ctrl_args.engine = &engine;
 
     // Create a thread for handling communication with the controller
     pthread_create(&controller_tid, NULL, controller_thread, (void *)&ctrl_args);
 
-    while (keep_running) {  // Main loop for car operations (runs until interrupted)
-        pthread_mutex_lock(&car_mem->mutex);
+    // Main loop for car operations: apply whatever changed, then sleep until the next change
+    // to shared memory or the end of the running door or travel phase
 
-        // If emergency stop is pressed, enable emergency mode
-        if (car_mem->emergency_stop) {
-            car_mem->emergency_mode = 1;
-            pthread_mutex_unlock(&car_mem->mutex);
-            continue;
+    pthread_mutex_lock(&car_mem->mutex);
+    while (keep_running) {
+        uint64_t now = monotonic_ms();
+        int changed = car_engine_step(&engine, now);
+        timer *expired;
+        if (!changed && (expired = timer_pop_expired(&timers, now)) != NULL) {
+            car_engine_expire((car_engine *)expired->data);  // One transition per pass, so each is published
+            changed = 1;
         }
-
-        // Handle emergency mode
-        if (car_mem->emergency_mode == 1) {
-            // Doors can be opened and closed manually in emergency mode, but the elevator does not move
-            // Handle open and close button actions here (code omitted for brevity)
-            pthread_mutex_unlock(&car_mem->mutex);
+        if (changed) {
+            pthread_cond_broadcast(&car_mem->cond);  // Notify the controller thread and other processes
             continue;
         }
-
-        // Handle individual service mode, which allows manual control of the elevator (code omitted for brevity)
-        pthread_mutex_unlock(&car_mem->mutex);
-        continue;
-
-        // Handle open and close buttons (code omitted for brevity)
-        pthread_mutex_unlock(&car_mem->mutex);
-
-        sleep_ms(10);  // Small delay before the next iteration
+        uint64_t deadline = timer_next_deadline(&timers);
+        if (deadline) {
+            wait_until(car_mem, deadline);
+        } else {
+            pthread_cond_wait(&car_mem->cond, &car_mem->mutex);
+        }
     }
+    pthread_mutex_unlock(&car_mem->mutex);
+    timer_heap_free(&timers);
 
+    // The signal thread has already woken every waiting thread. Remove the shared memory name
+    // straight away; the mapping stays valid until the threads are done with it.
+    unlink_shared_memory(shm_name);
     pthread_join(controller_tid, NULL);  // Wait for the controller thread to finish
-    unlink_shared_memory(shm_name);  // Unlink and close shared memory
+    pthread_cancel(signal_tid);          // Still waiting if SIGINT arrived before it started
+    pthread_join(signal_tid, NULL);
     close_shared_memory(car_mem);    // Clean up shared memory
 }
 
 int main(int argc, char *argv[]) {
+    car_options options = {0};
+    int fleet = argc >= 3 && strcmp(argv[1], "--fleet") == 0;  // Many cars in this process (see fleet.h)
+
+    // Options may follow the four required arguments, or the fleet spec
+    for (int i = fleet ? 3 : 5; i < argc; ++i) {
+        if (strcmp(argv[i], "--binary") == 0) {
+            options.binary = 1;
+        } else if (strcmp(argv[i], "--heartbeat-ms") == 0 && i + 1 < argc) {
+            options.heartbeat_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--motion") == 0 && i + 1 < argc) {
+            // Cruising time per floor and time to reach cruising speed, e.g. "40:300"
+            if (sscanf(argv[++i], "%d:%d", &options.motion.cruise_ms, &options.motion.accel_ms) != 2 ||
+                options.motion.cruise_ms <= 0 || options.motion.accel_ms < 0) {
+                argc = 0;
+            }
+        } else if (strcmp(argv[i], "--itinerary") == 0) {
+            options.itinerary = 1;
+        } else if (strcmp(argv[i], "--shm") == 0 && !fleet) {
+            options.shm = 1;  // Each link needs a receiver thread, so fleet cars use sockets only
+        } else if (strcmp(argv[i], "--workers") == 0 && fleet && i + 1 < argc) {
+            options.workers = atoi(argv[++i]);
+        } else {
+            argc = 0;  // Unknown option: fall through to the usage message
+        }
+    }
+
     // Validate the number of arguments
-    if (argc != 5) {
-        fprintf(stderr, "Usage: %s {name} {lowest floor} {highest floor} {delay}\n", argv[0]);
+    if (argc < (fleet ? 3 : 5)) {
+        fprintf(stderr, "Usage: %s {name} {lowest floor} {highest floor} {delay} [options] [--shm]\n"
+                        "       %s --fleet {spec} [--workers {n}] [options]\n"
+                        "Options: [--binary] [--heartbeat-ms {ms}] [--itinerary] [--motion {cruise ms}:{accel ms}]\n",
+                argv[0], argv[0]);
         return EXIT_FAILURE;
     }
 
+    if (fleet) {
+        return run_fleet(argv[2], &options) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     const char *name = argv[1];
     const char *lowest_floor = argv[2];
     const char *highest_floor = argv[3];
@@ -245,7 +584,7 @@ int main(int argc, char *argv[]) {
 
     // Set up signal handlers and run the car
     setup_signal_handler(int_handler);
-    run_car(name, lowest_floor, highest_floor, delay);
+    run_car(name, lowest_floor, highest_floor, delay, &options);
 
     return EXIT_SUCCESS;  // Return success
 }
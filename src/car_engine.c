@@ -0,0 +1,283 @@
+// car_engine.c
+
+#include "car_engine.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int status_is(const car_engine *engine, const char *status) {
+    return strcmp(engine->status, status) == 0;
+}
+
+// Drop the first itinerary stop once the doors start opening there
+static void itinerary_arrive(car_engine *engine) {
+    if (engine->itinerary_len > 0 && status_is(engine, "Opening") &&
+        engine->itinerary[0] == floor_to_level(engine->car_mem->current_floor)) {
+        memmove(engine->itinerary, engine->itinerary + 1, --engine->itinerary_len * sizeof(int));
+    }
+}
+
+// Time the travel phase of a car that is at its current floor at at_ms: it ends when the car
+// reaches the next floor towards its destination. A destination in the same direction only
+// changes the length of the trip under way; one behind the car starts a new trip.
+static void plan_travel(car_engine *engine, uint64_t at_ms) {
+    int current = floor_to_level(engine->car_mem->current_floor);
+    int destination = floor_to_level(engine->car_mem->destination_floor);
+    int direction = destination > current ? 1 : -1;
+    if (destination == current) {
+        return;  // travel_step() stops the car here
+    }
+    if (direction != engine->trip_direction) {
+        engine->trip_origin = current;
+        engine->trip_direction = direction;
+        engine->trip_start_ms = at_ms;
+    }
+    engine->trip_destination = destination;
+    int floors = abs(destination - engine->trip_origin);
+    engine->phase_end_ms = engine->trip_start_ms + motion_pass_ms(&engine->motion, floors, abs(current - engine->trip_origin) + 1);
+}
+
+// Move the car into a new status whose phase starts at start_ms
+static void set_status(car_engine *engine, const char *status, uint64_t start_ms) {
+    snprintf(engine->car_mem->status, STATUS_STR_SIZE, "%s", status);
+    memcpy(engine->status, engine->car_mem->status, STATUS_STR_SIZE);
+    engine->phase_end_ms = start_ms + engine->delay;
+    engine->trip_direction = 0;
+    if (status_is(engine, "Between")) {
+        plan_travel(engine, start_ms);  // Setting off from rest
+    }
+    itinerary_arrive(engine);
+}
+
+// Once the doors have closed, make the next itinerary stop the destination and set off for it
+// at start_ms (or reopen the doors, if the controller wants this floor served again). Returns 1
+// if the car moved on.
+static int itinerary_next(car_engine *engine, uint64_t start_ms) {
+    car_shared_mem *car_mem = engine->car_mem;
+    if (engine->itinerary_len == 0 || car_mem->individual_service_mode || car_mem->emergency_mode) {
+        return 0;
+    }
+    level_to_floor(engine->itinerary[0], car_mem->destination_floor);
+    if (strcmp(car_mem->destination_floor, car_mem->current_floor) == 0) {
+        set_status(engine, "Opening", start_ms);
+    } else {
+        set_status(engine, "Between", start_ms);
+    }
+    return 1;
+}
+
+// Schedule the phase timer if the running phase ends by itself, or cancel it if the car is
+// waiting for a button, a destination or a mode change
+static void engine_arm(car_engine *engine) {
+    car_shared_mem *car_mem = engine->car_mem;
+    int manual = car_mem->individual_service_mode || car_mem->emergency_mode;
+    if (status_is(engine, "Opening") || status_is(engine, "Closing") ||
+        (status_is(engine, "Open") && !manual) ||
+        (status_is(engine, "Between") && !car_mem->emergency_mode)) {
+        if (timer_schedule(engine->timers, &engine->phase, engine->phase_end_ms) != 0) {
+            perror("timer_schedule");
+            exit(EXIT_FAILURE);  // Only possible while the heap is growing
+        }
+    } else {
+        timer_cancel(engine->timers, &engine->phase);
+    }
+}
+
+// Advance the car by one floor at the end of a travel phase, stopping when it reaches its
+// destination: doors open there, except in individual service mode
+static void travel_step(car_engine *engine, int manual) {
+    car_shared_mem *car_mem = engine->car_mem;
+    int current = floor_to_level(car_mem->current_floor);
+    int destination = floor_to_level(car_mem->destination_floor);
+
+    if (destination != current) {
+        current += destination > current ? 1 : -1;
+        level_to_floor(current, car_mem->current_floor);
+    }
+    if (destination == current) {
+        set_status(engine, manual ? "Closed" : "Opening", engine->phase_end_ms);
+    } else {
+        plan_travel(engine, engine->phase_end_ms);  // Carry on to the next floor
+    }
+}
+
+void car_state_init(car_shared_mem *car_mem, const char *lowest_floor) {
+    pthread_mutex_lock(&car_mem->mutex);
+    snprintf(car_mem->current_floor, FLOOR_STR_SIZE, "%.*s", FLOOR_STR_SIZE - 1, lowest_floor);
+    snprintf(car_mem->destination_floor, FLOOR_STR_SIZE, "%.*s", FLOOR_STR_SIZE - 1, lowest_floor);
+    snprintf(car_mem->status, STATUS_STR_SIZE, "Closed");
+    car_mem->open_button = 0;
+    car_mem->close_button = 0;
+    car_mem->door_obstruction = 0;
+    car_mem->overload = 0;
+    car_mem->emergency_stop = 0;
+    car_mem->individual_service_mode = 0;
+    car_mem->emergency_mode = 0;
+    pthread_mutex_unlock(&car_mem->mutex);
+}
+
+void car_engine_init(car_engine *engine, car_shared_mem *car_mem, const char *lowest_floor, const char *highest_floor,
+                     int delay, const motion_profile *motion, timer_heap *timers, void *owner) {
+    engine->car_mem = car_mem;
+    engine->lowest_level = floor_to_level(lowest_floor);
+    engine->highest_level = floor_to_level(highest_floor);
+    engine->delay = delay;
+    if (motion) {
+        engine->motion = *motion;
+    } else {
+        engine->motion.cruise_ms = delay;
+        engine->motion.accel_ms = 0;
+    }
+    engine->trip_direction = 0;
+    engine->status[0] = '\0';  // Adopts the initial status on the first step
+    engine->phase_end_ms = 0;
+    engine->timers = timers;
+    timer_init(&engine->phase, owner);
+    engine->itinerary_len = 0;
+}
+
+int car_engine_step(car_engine *engine, uint64_t now) {
+    car_shared_mem *car_mem = engine->car_mem;
+    int changed = 0;
+
+    if (strcmp(car_mem->status, engine->status) != 0) {
+        memcpy(engine->status, car_mem->status, STATUS_STR_SIZE);
+        engine->phase_end_ms = now + engine->delay;
+        engine->trip_direction = 0;
+        itinerary_arrive(engine);
+    }
+
+    // If emergency stop is pressed, enable emergency mode
+    if (car_mem->emergency_stop && !car_mem->emergency_mode) {
+        car_mem->emergency_mode = 1;
+        changed = 1;
+    }
+
+    // A destination outside the car's range (or not a floor at all) is cancelled
+    int destination = floor_to_level(car_mem->destination_floor);
+    if (!is_valid_floor(car_mem->destination_floor) || destination < engine->lowest_level || destination > engine->highest_level) {
+        memcpy(car_mem->destination_floor, car_mem->current_floor, FLOOR_STR_SIZE);
+        changed = 1;
+    }
+
+    // A new destination ahead of a trip under way re-times the floor the car is approaching:
+    // it carries on at speed towards one further away, or starts braking for a nearer one
+    destination = floor_to_level(car_mem->destination_floor);
+    if (status_is(engine, "Between") && engine->trip_direction != 0 && destination != engine->trip_destination &&
+        (destination - floor_to_level(car_mem->current_floor)) * engine->trip_direction > 0) {
+        plan_travel(engine, now);
+    }
+
+    // Buttons are consumed whether or not they can act (the doors stay shut between floors)
+    if (car_mem->open_button) {
+        car_mem->open_button = 0;
+        changed = 1;
+        if (status_is(engine, "Open")) {
+            engine->phase_end_ms = now + engine->delay;  // Hold the doors for another phase
+        } else if (status_is(engine, "Closing") || status_is(engine, "Closed")) {
+            set_status(engine, "Opening", now);
+        }
+    }
+    if (car_mem->close_button) {
+        car_mem->close_button = 0;
+        changed = 1;
+        if (status_is(engine, "Open")) {
+            set_status(engine, "Closing", now);
+        }
+    }
+
+    // Closed doors with somewhere to go: set off
+    if (!changed && status_is(engine, "Closed") && !car_mem->emergency_mode) {
+        if (strcmp(car_mem->destination_floor, car_mem->current_floor) != 0) {
+            set_status(engine, "Between", now);
+            changed = 1;
+        } else {
+            changed = itinerary_next(engine, now);
+        }
+    }
+
+    engine_arm(engine);
+    return changed;
+}
+
+// In individual service and emergency mode the doors only move when a button is pressed, and
+// in emergency mode the car does not move at all; the timer is not armed for those phases
+void car_engine_expire(car_engine *engine) {
+    int manual = engine->car_mem->individual_service_mode || engine->car_mem->emergency_mode;
+    if (status_is(engine, "Opening")) {
+        set_status(engine, "Open", engine->phase_end_ms);
+    } else if (status_is(engine, "Open")) {
+        set_status(engine, "Closing", engine->phase_end_ms);
+    } else if (status_is(engine, "Closing")) {
+        uint64_t closed_ms = engine->phase_end_ms;
+        set_status(engine, "Closed", closed_ms);
+        itinerary_next(engine, closed_ms);  // No round trip to the controller first
+    } else if (status_is(engine, "Between")) {
+        travel_step(engine, manual);
+    }
+    engine_arm(engine);
+}
+
+void car_engine_set_itinerary(car_engine *engine, const int *levels, int count) {
+    car_shared_mem *car_mem = engine->car_mem;
+    int current = floor_to_level(car_mem->current_floor);
+    int skip = count > 0 && levels[0] == current &&
+               (strcmp(car_mem->status, "Opening") == 0 || strcmp(car_mem->status, "Open") == 0);
+
+    engine->itinerary_len = count - skip;
+    if (engine->itinerary_len > 0) {
+        char floor[FLOOR_STR_SIZE];
+        memcpy(engine->itinerary, levels + skip, engine->itinerary_len * sizeof(int));
+        level_to_floor(engine->itinerary[0], floor);
+        car_apply_floor(car_mem, floor);
+    } else {
+        pthread_cond_broadcast(&car_mem->cond);
+    }
+}
+
+int parse_itinerary(const char *message, uint16_t *version, int *levels) {
+    unsigned int v;
+    int used;
+    if (sscanf(message, ITINERARY_TOKEN " %u%n", &v, &used) != 1 || v > UINT16_MAX) {
+        return -1;
+    }
+    *version = (uint16_t)v;
+
+    int count = 0;
+    char floor[FLOOR_STR_SIZE];
+    const char *p = message + used;
+    while (sscanf(p, " %3s%n", floor, &used) == 1) {
+        if (count == ITINERARY_MAX_STOPS || !is_valid_floor(floor)) {
+            return -1;
+        }
+        levels[count++] = floor_to_level(floor);
+        p += used;
+    }
+    return count;
+}
+
+void car_apply_floor(car_shared_mem *car_mem, const char *floor) {
+    snprintf(car_mem->destination_floor, FLOOR_STR_SIZE, "%.*s", FLOOR_STR_SIZE - 1, floor);
+    if (strcmp(car_mem->destination_floor, car_mem->current_floor) == 0 && strcmp(car_mem->status, "Closed") == 0) {
+        snprintf(car_mem->status, STATUS_STR_SIZE, "Opening");
+    }
+    pthread_cond_broadcast(&car_mem->cond);  // Wake the car and anything else watching it
+}
+
+int state_changed(const car_shared_mem *car_mem, const reported_state *reported) {
+    return strcmp(car_mem->status, reported->status) != 0 ||
+           strcmp(car_mem->current_floor, reported->current_floor) != 0 ||
+           strcmp(car_mem->destination_floor, reported->destination_floor) != 0;
+}
+
+void record_state(const car_shared_mem *car_mem, reported_state *reported) {
+    memcpy(reported->status, car_mem->status, STATUS_STR_SIZE);
+    memcpy(reported->current_floor, car_mem->current_floor, FLOOR_STR_SIZE);
+    memcpy(reported->destination_floor, car_mem->destination_floor, FLOOR_STR_SIZE);
+    reported->sent_ms = monotonic_ms();
+}
+
+void format_status(const car_shared_mem *car_mem, char *message, size_t size) {
+    snprintf(message, size, "STATUS %s %s %s", car_mem->status, car_mem->current_floor, car_mem->destination_floor);
+}
@@ -1,6 +1,15 @@
+#define _GNU_SOURCE                   // accept4() for non-blocking accepted sockets
+
 #include "../headers/network.h"       // Include functions for network communication
 #include "../headers/utils.h"         // Include utility functions (helpers for signals, time, etc.)
 #include "../headers/controller.h"    // Include controller-specific functions and definitions
+#include "../headers/registry.h"      // Include the generational handle registry used for cars
+#include "../headers/stop_set.h"      // Include the per-car stop bitmaps
+#include "../headers/assignment.h"    // Include the min-cost matching used for batch assignment
+#include "../headers/uring.h"         // Include the io_uring wrapper for the optional backend
+#include "../headers/shm_link.h"      // Include the shared-memory rings for same-host cars
+#include "../headers/timer.h"         // Include the deadline timers used for heartbeat checks
+#include "../headers/motion.h"        // Include the acceleration profiles used to time trips
 #include "shared_memory.h"            // Include shared memory functions
 #include <stdio.h>                    // Standard I/O library
 #include <stdlib.h>                   // Standard library for memory allocation, process control
@@ -11,9 +20,13 @@
 #include <netinet/in.h>               // Internet address family for sockets
 #include <sys/socket.h>               // Socket-related functions
 #include <sys/types.h>                // Types for sockets
+#include <sys/epoll.h>                // epoll event notification for the event loops
+#include <sys/eventfd.h>              // eventfd used to wake the event loops on shutdown
 #include <errno.h>                    // Error numbers for socket functions
+#include <fcntl.h>                    // File control options (non-blocking listen socket)
 #include <arpa/inet.h>                // Functions for internet operations (like `inet_addr()`)
 #include <limits.h>                   // Definitions for integer limits (e.g., INT_MAX)
+#include <poll.h>                     // POLLIN for io_uring poll requests
 
 // Global flag to control whether the program should keep running
 static volatile sig_atomic_t keep_running = 1;
@@ -27,25 +40,60 @@ static void int_handler(int dummy) {
 // Enumeration for elevator direction states: UP, DOWN, or IDLE (not moving)
 typedef enum { UP = 1, DOWN = -1, IDLE = 0 } Direction;
 
-// Structure for a floor request in the elevator system
-typedef struct floor_request {
-    char floor[FLOOR_STR_SIZE];      // Requested floor
-    Direction direction;             // Direction of the request (UP or DOWN)
-    struct floor_request *next;      // Pointer to the next request in the queue
-} floor_request;
+// Door and travel state reported by a car, in the order a stop is normally served
+typedef enum { CAR_CLOSED, CAR_OPENING, CAR_OPEN, CAR_CLOSING, CAR_BETWEEN } car_status;
+
+#define DEFAULT_CAR_DELAY_MS 100      // Assumed per-floor/door-phase time until a car's delay is observed
+#define SNAPSHOT_MAX_DROPS 64         // Pending pickup/drop-off pairs a snapshot carries
+
+// Immutable view of a car's dispatch-relevant state. Car sessions publish a new snapshot
+// under a sequence lock whenever the state changes, and dispatch reads it without locking.
+// Floors are levels (see floor_to_level()) so distances are simple differences.
+typedef struct {
+    registry_handle handle;          // Car the snapshot belongs to (guards against slot reuse)
+    int lowest_level;                // Lowest accessible level
+    int highest_level;               // Highest accessible level
+    int current_level;               // Current level
+    int direction;                   // Sweep direction of the car's stop set (UP, DOWN, or IDLE)
+    int status;                      // Door/travel state (car_status)
+    int delay_ms;                    // Estimated time per floor travelled and per door phase
+    motion_profile motion;           // Travel timing the car announced (cruise_ms 0 = delay_ms per floor)
+    int pending_stops;               // Number of stops in the stop set
+    stop_bits stops;                 // Pending stops, for ETA simulation
+    int pending_drops;               // Number of drop-offs waiting for their pickup
+    uint32_t drops[SNAPSHOT_MAX_DROPS]; // The first of them, packed by pack_drop()
+} car_snapshot;
+
+typedef struct connection connection;
+
+#define NO_TARGET STOP_NONE           // car_info.target when the car has not been sent anywhere
 
 // Structure to store information about each elevator car
 typedef struct {
-    int sockfd;                      // Socket file descriptor for network communication
+    registry_handle handle;          // Handle of this car in the car registry
+    connection *conn;                // Connection the car is registered on
     char name[32];                   // Name of the car
     char lowest_floor[FLOOR_STR_SIZE]; // Lowest accessible floor
     char highest_floor[FLOOR_STR_SIZE]; // Highest accessible floor
     char status[16];                 // Current status (e.g., "Open", "Closed", etc.)
     char current_floor[FLOOR_STR_SIZE]; // Current floor
     char destination_floor[FLOOR_STR_SIZE]; // Destination floor
-    Direction direction;             // Direction of movement (UP, DOWN, or IDLE)
-    floor_request *queue_head;       // Head of the queue for floor requests
-    pthread_mutex_t queue_mutex;     // Mutex for synchronizing access to the request queue
+    int delay_ms;                    // Observed time per floor/door phase (moving average)
+    motion_profile motion;           // Travel timing from the car's MOTION (cruise_ms 0 = none)
+    uint64_t status_changed_ms;      // Monotonic time of the last status or floor change
+    stop_set stops;                  // Pending pickups and drop-offs
+    int target;                      // Level last sent in a FLOOR message, or NO_TARGET
+    int itinerary;                   // Whether the car takes ITINERARY messages instead of FLOOR
+    uint16_t itinerary_version;      // Version of the last ITINERARY sent
+    int itinerary_len;               // Stops of the last ITINERARY the car has not reached yet
+    int itinerary_stops[ITINERARY_MAX_STOPS]; // Those stops, as levels
+    int binary;                      // Whether the car negotiated the binary protocol
+    uint16_t tx_seq;                 // Sequence number of the last binary FLOOR sent
+    uint16_t rx_seq;                 // Sequence number of the last binary STATUS applied
+    int rx_seen;                     // Whether any binary STATUS has been applied
+    pthread_mutex_t queue_mutex;     // Mutex for synchronizing access to the stop set
+    uint32_t snapshot_seq;           // Sequence lock for snapshot: odd while being rewritten
+    car_snapshot snapshot;           // Latest published state, read lock-free by dispatch
 } car_info;
 
 // Structure for handling incoming call requests
@@ -55,417 +103,2174 @@ typedef struct {
     Direction direction;               // Direction of the call
 } call_request;
 
-// Structure for passing arguments to client threads
+#define EVENT_THREADS 2               // Number of event loop threads servicing connections
+#define MAX_EVENTS 64                 // Maximum epoll events handled per wakeup
+#define ACCEPT_BATCH 32               // Maximum connections accepted per listen socket wakeup
+#define URING_ENTRIES 512             // Submission queue size per io_uring loop
+#define URING_BUFFERS 512             // Provided receive buffers per io_uring loop (power of two)
+#define URING_BUFFER_SIZE 1024        // Size of each receive buffer
+#define URING_BUFFER_GROUP 1          // Buffer group ID used by every loop's ring
+
+// Kind of session running on a connection, decided by its first message.
+// A plain "CALL {source} {destination}" is answered once and closed (CONN_CALL), while a
+// tagged "CALL {id} {source} {destination}" keeps the connection open for pipelined calls
+// whose replies carry the same ID ("CAR {id} {name}" / "UNAVAILABLE {id}").
+typedef enum { CONN_NEW, CONN_CAR, CONN_CALL, CONN_CALL_SESSION } conn_kind;
+
+// Per-connection session state, owned by exactly one event loop. Other threads only write to
+// the connection, through its outbound queue, and the owning loop drains whatever the socket
+// did not take immediately, so a slow peer never blocks the thread that produced a message.
+struct connection {
+    int sockfd;                       // Socket file descriptor for the client
+    int epoll_fd;                     // epoll instance of the owning event loop
+    conn_kind kind;                   // Session type (unknown until the first message arrives)
+    registry_handle car;              // Car registered on this connection (CONN_CAR only)
+    frame_reader rx;                  // Bytes received but not yet handed to the session
+    int waiting;                      // Calls from this connection held in a coalescing group
+    pthread_mutex_t tx_mutex;         // Protects tx, want_out and closing
+    tx_queue tx;                      // Frames not yet written to the socket
+    int want_out;                     // Whether EPOLLOUT is armed to drain tx
+    int closing;                      // Close once tx has drained
+    int corked;                       // Queue frames without sending until uncorked
+    int heartbeat_ms;                 // Heartbeat interval the car asked for (0 = none)
+    uint64_t last_rx_ms;              // When anything was last received (heartbeat cars; atomic,
+                                      // as a link thread also writes it)
+    uint64_t last_ping_ms;            // When HEARTBEAT_MESSAGE was last sent (heartbeat cars)
+    int recv_armed;                   // io_uring: a multishot receive is outstanding
+    int retired;                      // io_uring: closed, freed once the receive completes
+    shm_link *link;                   // Shared-memory link carrying STATUS and FLOOR (SHM1 cars)
+    pthread_t link_tid;               // Thread applying the STATUS messages from the link
+    timer heartbeat;                  // Next heartbeat or liveness check (pending while watched)
+};
+
+// A caller waiting for its call's coalescing group to be dispatched
+typedef struct call_waiter {
+    connection *conn;                 // Connection to answer on
+    int tagged;                       // Whether the reply must carry the caller's request ID
+    unsigned int tag;                 // Request ID of a tagged call
+    call_request call;                // The call as received
+    struct call_waiter *next;         // Next caller in the same group
+} call_waiter;
+
+// Calls from one floor in one direction that arrived within the coalescing window. They are
+// assigned together, so the car makes a single stop for all of them.
+typedef struct call_group {
+    int source;                       // Source level shared by every call in the group
+    Direction direction;              // Direction shared by every call in the group
+    call_request span;                // Source and the farthest destination, for car selection
+    uint64_t deadline_ms;             // Monotonic time the group is dispatched at
+    call_waiter *waiters;             // Callers to answer, in arrival order
+    call_waiter **tail;               // Where the next caller is linked
+    struct call_group *next;          // Next group, in deadline order
+} call_group;
+
+// Structure describing one event loop thread
 typedef struct {
-    int sockfd;                       // Socket file descriptor for network communication
-    char *message;                    // Message received from the client (car or call)
-} client_arg_t;
+    int epoll_fd;                     // epoll instance watching this loop's connections
+    pthread_t tid;                    // Thread running the loop
+    timer_heap timers;                // Heartbeat timers of the car sessions it watches
+    uring ring;                       // io_uring backend only: the loop's ring
+    uring_buffers buffers;            // io_uring backend only: receive buffers for the ring
+} event_loop;
 
-#define MAX_CARS 10                   // Maximum number of cars supported
-static car_info cars[MAX_CARS];        // Array to store all car information
-static int num_cars = 0;               // Current number of cars in the system
+// Registry holding every car in service. Records never move, and a removed car's slot is
+// recycled under a new generation, so a handle held by a session or by dispatch can never
+// end up pointing at a different car.
+static registry car_registry;
 
-pthread_mutex_t data_mutex = PTHREAD_MUTEX_INITIALIZER;  // Mutex to protect car data
+#define MAX_LISTENERS 2                // TCP and Unix domain listeners
+#define DEFAULT_LISTEN_BACKLOG 128     // Pending connections queued per listener (see --backlog)
 
-// Function to remove a car from service (called when a car goes into emergency or individual service mode)
-void remove_car_from_service(car_info *car) {
-    pthread_mutex_lock(&data_mutex);  // Lock to synchronize access to car data
+static int listen_socks[MAX_LISTENERS]; // Listening sockets shared by all event loops
+static int listener_count = 0;          // Number of entries in listen_socks
+static int listen_tcp = 1;              // Whether to listen on CONTROLLER_IP:CONTROLLER_PORT
+static const char *unix_path = NULL;    // Unix socket path to listen on as well, if any
+static int listen_backlog = DEFAULT_LISTEN_BACKLOG; // Backlog passed to listen()
+static int use_io_uring = 0;            // Run the loops on io_uring instead of epoll (--io-uring)
+static int wake_fd = -1;              // eventfd signalled to stop all event loops
+static event_loop loops[EVENT_THREADS]; // The fixed set of event loops
 
-    // Remove all floor requests for this car
-    pthread_mutex_lock(&car->queue_mutex);
-    floor_request *req = car->queue_head;
-    while (req) {
-        floor_request *tmp = req;
-        req = req->next;
-        free(tmp);
+// Hall-call coalescing: calls are held for up to coalesce_window_ms so that callers pressing
+// the same button during a peak share one assignment. 0 dispatches every call immediately.
+static int coalesce_window_ms = 0;
+static pthread_mutex_t coalesce_mutex = PTHREAD_MUTEX_INITIALIZER;
+static call_group *coalesce_head = NULL;     // Pending groups, oldest (earliest deadline) first
+static call_group **coalesce_tail = &coalesce_head;
+
+// Destination dispatch: cars are chosen to keep passengers bound for the same or nearby floors
+// together and to limit the number of drop-offs per trip, rather than for the earliest pickup
+static int destination_dispatch = 0;
+#define DD_NEARBY_LEVELS 2            // Destinations this close count as "nearby"
+#define DD_MAX_TRIP_STOPS 4           // Most drop-offs a car is given per trip while others can serve
+#define DD_FULL_PENALTY (1 << 28)     // Score added for a car whose trip is full
+
+// Batch assignment: calls collected over the horizon are assigned together by solving a
+// min-cost matching of calls to cars, instead of greedily one at a time. With reassignment,
+// calls from session clients stay open until their pickup and may move to a better car.
+static int batch_horizon_ms = 0;
+static int reassign_calls = 0;
+#define BATCH_MAX_ROWS 64             // Calls matched together per batch (the rest go greedily)
+#define BATCH_MAX_CARS 64             // Cars matched per batch (each call's best car, then the
+                                      // best placed of the rest)
+
+// A session call whose pickup has not been served yet and that may be moved to another car
+typedef struct call_assignment {
+    connection *conn;                 // Session to notify if the call moves
+    unsigned int tag;                 // Caller's request ID
+    call_request call;                // The call
+    registry_handle car;              // Car currently serving it
+    struct call_assignment *next;
+} call_assignment;
+
+static call_assignment *open_assignments = NULL;  // Protected by coalesce_mutex
+
+// Counters for calls moved off cars that left service, reported by a "STATS" request
+static uint64_t stat_reassigned = 0;  // Orphaned pickups placed with another car
+static uint64_t stat_unplaced = 0;    // Orphaned pickups no remaining car could take
+static uint64_t stat_stranded = 0;    // Drop-offs for passengers aboard a car that left service
+static uint64_t stat_added_ms = 0;    // Total estimated extra wait of the reassigned pickups
+
+// Function to act on the result of a flush: watch for writability while data remains, and shut
+// the socket down (so the owning loop closes the connection) once a closing connection has
+// drained or the socket has failed. Must be called with conn->tx_mutex held.
+static void after_flush(connection *conn, int result) {
+    // With io_uring the ring receives, so the epoll set only ever watches for writability
+    uint32_t base_events = use_io_uring ? 0 : EPOLLIN | EPOLLRDHUP;
+    if (result == 1 && !conn->want_out) {
+        struct epoll_event ev;
+        ev.events = base_events | EPOLLOUT;
+        ev.data.ptr = conn;
+        epoll_ctl(conn->epoll_fd, EPOLL_CTL_MOD, conn->sockfd, &ev);
+        conn->want_out = 1;
+    } else if (result == 0 && conn->want_out) {
+        struct epoll_event ev;
+        ev.events = base_events;
+        ev.data.ptr = conn;
+        epoll_ctl(conn->epoll_fd, EPOLL_CTL_MOD, conn->sockfd, &ev);
+        conn->want_out = 0;
     }
-    pthread_mutex_unlock(&car->queue_mutex);
-    pthread_mutex_destroy(&car->queue_mutex);
+    if (result < 0 || (result == 0 && conn->closing)) {
+        shutdown(conn->sockfd, SHUT_RDWR);
+    }
+}
 
-    // Remove the car from the array
-    for (int i = 0; i < num_cars; ++i) {
-        if (&cars[i] == car) {
-            cars[i] = cars[--num_cars];  // Replace the car with the last car in the array
-            break;
-        }
+// Function to queue a frame on a connection and write as much of it as the socket takes now.
+// A superseding frame (FLOOR) replaces an earlier one still waiting in the queue. If the
+// queue is full the peer is not reading, so the connection is shut down rather than buffered
+// without bound. Safe to call from any thread while the connection is known to be open.
+void conn_send_frame(connection *conn, const void *data, size_t len, int supersede) {
+    pthread_mutex_lock(&conn->tx_mutex);
+    if (tx_queue_push_frame(&conn->tx, data, len, supersede) != 0) {
+        shutdown(conn->sockfd, SHUT_RDWR);
+    } else if (!conn->want_out && !conn->corked) {
+        // While EPOLLOUT is armed the owning loop drains the queue in order
+        after_flush(conn, tx_queue_flush(&conn->tx, conn->sockfd));
     }
-    pthread_mutex_unlock(&data_mutex);  // Unlock the data mutex
-    close(car->sockfd);  // Close the socket for the car
-}
-
-// Thread function to handle communication with a car
-void *handle_car(void *arg) {
-    client_arg_t *car_arg = (client_arg_t *)arg;  // Cast the argument to the expected type
-    int sockfd = car_arg->sockfd;
-    char *message = car_arg->message;
-    free(arg);
-    car_info *car = NULL;
-
-    // If the message starts with "CAR", process the car information
-    if (strncmp(message, "CAR ", 4) == 0) {
-        char car_name[32], low_floor[FLOOR_STR_SIZE], high_floor[FLOOR_STR_SIZE];
-        if (sscanf(message + 4, "%31s %11s %11s", car_name, low_floor, high_floor) != 3) {
-            free(message);
-            close(sockfd);
-            return NULL;
-        }
-
-        free(message);
-
-        pthread_mutex_lock(&data_mutex);
-        if (num_cars >= MAX_CARS) {  // If maximum cars are already in the system
-            pthread_mutex_unlock(&data_mutex);
-            close(sockfd);
-            return NULL;
-        }
-
-        // Add the new car to the system
-        car = &cars[num_cars++];
-        car->sockfd = sockfd;
-        strncpy(car->name, car_name, sizeof(car->name) - 1);
-        car->name[sizeof(car->name) - 1] = '\0';
-        strncpy(car->lowest_floor, low_floor, sizeof(car->lowest_floor) - 1);
-        car->lowest_floor[sizeof(car->lowest_floor) - 1] = '\0';
-        strncpy(car->highest_floor, high_floor, sizeof(car->highest_floor) - 1);
-        car->highest_floor[sizeof(car->highest_floor) - 1] = '\0';
-        car->queue_head = NULL;
-        pthread_mutex_init(&car->queue_mutex, NULL);
-
-        strncpy(car->status, "Closed", sizeof(car->status) - 1);
-        car->status[sizeof(car->status) - 1] = '\0';
-        strncpy(car->current_floor, low_floor, sizeof(car->current_floor) - 1);
-        car->current_floor[sizeof(car->current_floor) - 1] = '\0';
-        strncpy(car->destination_floor, low_floor, sizeof(car->destination_floor) - 1);
-        car->destination_floor[sizeof(car->destination_floor) - 1] = '\0';
-        car->direction = IDLE;
-
-        pthread_mutex_unlock(&data_mutex);
-
-        // Main loop to handle car messages
-        while (keep_running) {
-            if (receive_message(sockfd, &message) != 0) {  // Receive message from car
-                break;  // If there's an error, exit the loop
-            }
-            if (strncmp(message, "STATUS ", 7) == 0) {  // If the message is a status update
-                pthread_mutex_lock(&car->queue_mutex);
-                char prev_current_floor[FLOOR_STR_SIZE];
-                strncpy(prev_current_floor, car->current_floor, FLOOR_STR_SIZE);
-
-                sscanf(message + 7, "%15s %11s %11s", car->status, car->current_floor, car->destination_floor);
-
-                // Update car direction based on current and destination floors
-                int cmp = compare_floors(car->destination_floor, car->current_floor);
-                if (cmp > 0) {
-                    car->direction = UP;
-                } else if (cmp < 0) {
-                    car->direction = DOWN;
-                } else {
-                    car->direction = IDLE;
-                }
+    pthread_mutex_unlock(&conn->tx_mutex);
+}
 
-                // Check if the car has arrived at a requested floor
-                if ((strcmp(car->status, "Opening") == 0 || strcmp(car->status, "Open") == 0) &&
-                    car->queue_head && strcmp(car->queue_head->floor, car->current_floor) == 0) {
-                    floor_request *old_head = car->queue_head;
-                    car->queue_head = car->queue_head->next;
-                    free(old_head);
-
-                    // If there are more requests in the queue, update the destination floor
-                    if (car->queue_head) {
-                        char floor_msg[20];
-                        snprintf(floor_msg, sizeof(floor_msg), "FLOOR %s", car->queue_head->floor);
-                        send_message(car->sockfd, floor_msg);
-                        strncpy(car->destination_floor, car->queue_head->floor, sizeof(car->destination_floor) - 1);
-                        car->destination_floor[sizeof(car->destination_floor) - 1] = '\0';
-                    } else {
-                        car->direction = IDLE;
-                    }
-                }
+// Function to queue a text message on a connection (see conn_send_frame)
+void conn_send(connection *conn, const char *message, int supersede) {
+    conn_send_frame(conn, message, strlen(message), supersede);
+}
 
-                pthread_mutex_unlock(&car->queue_mutex);
-            } else if (strcmp(message, "INDIVIDUAL SERVICE") == 0 || strcmp(message, "EMERGENCY") == 0) {
-                // If the car enters individual service or emergency mode, remove it from service
-                remove_car_from_service(car);
-                free(message);
-                return NULL;
-            }
-            free(message);
+// Function to hold back frames queued on a connection, so replies to a burst of pipelined
+// requests leave in one send (and one segment) when the connection is uncorked
+void conn_cork(connection *conn) {
+    pthread_mutex_lock(&conn->tx_mutex);
+    conn->corked = 1;
+    pthread_mutex_unlock(&conn->tx_mutex);
+}
+
+// Function to send everything queued while the connection was corked
+void conn_uncork(connection *conn) {
+    pthread_mutex_lock(&conn->tx_mutex);
+    conn->corked = 0;
+    if (!conn->want_out && !tx_queue_empty(&conn->tx)) {
+        after_flush(conn, tx_queue_flush(&conn->tx, conn->sockfd));
+    }
+    pthread_mutex_unlock(&conn->tx_mutex);
+}
+
+// Function to write queued frames when the socket becomes writable (owning loop only)
+void conn_flush(connection *conn) {
+    pthread_mutex_lock(&conn->tx_mutex);
+    after_flush(conn, tx_queue_flush(&conn->tx, conn->sockfd));
+    pthread_mutex_unlock(&conn->tx_mutex);
+}
+
+// Function to close a connection once everything queued on it has been written
+void conn_finish(connection *conn) {
+    pthread_mutex_lock(&conn->tx_mutex);
+    conn->closing = 1;
+    if (tx_queue_empty(&conn->tx)) {
+        shutdown(conn->sockfd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&conn->tx_mutex);
+}
+
+// Function to construct a car record once, when the registry creates its slot. The queue
+// mutex lives as long as the registry, so it is never destroyed while another thread waits on it.
+void construct_car(void *record) {
+    car_info *car = (car_info *)record;
+    pthread_mutex_init(&car->queue_mutex, NULL);
+}
+
+// Function to convert a status string from a car into a car_status
+car_status parse_status(const char *status) {
+    if (strcmp(status, "Opening") == 0) return CAR_OPENING;
+    if (strcmp(status, "Open") == 0) return CAR_OPEN;
+    if (strcmp(status, "Closing") == 0) return CAR_CLOSING;
+    if (strcmp(status, "Between") == 0) return CAR_BETWEEN;
+    return CAR_CLOSED;
+}
+
+// Function to copy a snapshot field by field with relaxed atomic accesses, so a reader racing
+// a writer sees torn values only in ways the sequence check rejects
+void copy_snapshot(car_snapshot *dst, const car_snapshot *src) {
+    __atomic_store_n(&dst->handle, __atomic_load_n(&src->handle, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->lowest_level, __atomic_load_n(&src->lowest_level, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->highest_level, __atomic_load_n(&src->highest_level, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->current_level, __atomic_load_n(&src->current_level, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->direction, __atomic_load_n(&src->direction, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->status, __atomic_load_n(&src->status, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->delay_ms, __atomic_load_n(&src->delay_ms, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->motion.cruise_ms, __atomic_load_n(&src->motion.cruise_ms, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->motion.accel_ms, __atomic_load_n(&src->motion.accel_ms, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->pending_stops, __atomic_load_n(&src->pending_stops, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->stops.lowest, __atomic_load_n(&src->stops.lowest, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->stops.levels, __atomic_load_n(&src->stops.levels, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+
+    // Only the words covering the car's range carry stops
+    int words = (__atomic_load_n(&dst->stops.levels, __ATOMIC_RELAXED) + 63) / 64;
+    if (words > STOP_SET_WORDS) words = STOP_SET_WORDS;
+    for (int w = 0; w < words; ++w) {
+        __atomic_store_n(&dst->stops.up[w], __atomic_load_n(&src->stops.up[w], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        __atomic_store_n(&dst->stops.down[w], __atomic_load_n(&src->stops.down[w], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        __atomic_store_n(&dst->stops.car[w], __atomic_load_n(&src->stops.car[w], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        __atomic_store_n(&dst->stops.planned[w], __atomic_load_n(&src->stops.planned[w], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    }
+
+    int drops = __atomic_load_n(&src->pending_drops, __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->pending_drops, drops, __ATOMIC_RELAXED);
+    for (int i = 0; i < drops && i < SNAPSHOT_MAX_DROPS; ++i) {
+        __atomic_store_n(&dst->drops[i], __atomic_load_n(&src->drops[i], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    }
+}
+
+// Function to pack a pending pair into a snapshot entry: the pickup and drop-off as offsets
+// into the stop bitmaps, and whether the passenger travels up
+static uint32_t pack_drop(const pending_drop *p, int lowest) {
+    return (uint32_t)(p->pickup - lowest) << 16 | (uint32_t)(p->dest - lowest) << 1 | (p->direction == UP);
+}
+
+// Function to publish the car's current state as a new snapshot.
+// Must be called with car->queue_mutex held (which serialises writers).
+void publish_snapshot(car_info *car) {
+    // Odd sequence number tells readers a write is in progress
+    uint32_t seq = __atomic_load_n(&car->snapshot_seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&car->snapshot_seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    car_snapshot *snap = &car->snapshot;
+    __atomic_store_n(&snap->handle, car->handle, __ATOMIC_RELAXED);
+    __atomic_store_n(&snap->lowest_level, floor_to_level(car->lowest_floor), __ATOMIC_RELAXED);
+    __atomic_store_n(&snap->highest_level, floor_to_level(car->highest_floor), __ATOMIC_RELAXED);
+    __atomic_store_n(&snap->current_level, floor_to_level(car->current_floor), __ATOMIC_RELAXED);
+    __atomic_store_n(&snap->direction, car->stops.direction, __ATOMIC_RELAXED);
+    __atomic_store_n(&snap->status, (int)parse_status(car->status), __ATOMIC_RELAXED);
+    __atomic_store_n(&snap->delay_ms, car->delay_ms, __ATOMIC_RELAXED);
+    __atomic_store_n(&snap->motion.cruise_ms, car->motion.cruise_ms, __ATOMIC_RELAXED);
+    __atomic_store_n(&snap->motion.accel_ms, car->motion.accel_ms, __ATOMIC_RELAXED);
+    __atomic_store_n(&snap->pending_stops, stop_bits_count(&car->stops.bits, STOPS_ALL), __ATOMIC_RELAXED);
+
+    // The stop bitmaps are only written under the queue lock, so plain loads suffice here
+    const stop_bits *bits = &car->stops.bits;
+    __atomic_store_n(&snap->stops.lowest, bits->lowest, __ATOMIC_RELAXED);
+    __atomic_store_n(&snap->stops.levels, bits->levels, __ATOMIC_RELAXED);
+    for (int w = 0; w < (bits->levels + 63) / 64; ++w) {
+        __atomic_store_n(&snap->stops.up[w], bits->up[w], __ATOMIC_RELAXED);
+        __atomic_store_n(&snap->stops.down[w], bits->down[w], __ATOMIC_RELAXED);
+        __atomic_store_n(&snap->stops.car[w], bits->car[w], __ATOMIC_RELAXED);
+        __atomic_store_n(&snap->stops.planned[w], bits->planned[w], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&snap->pending_drops, car->stops.pending_count, __ATOMIC_RELAXED);
+    for (int i = 0; i < car->stops.pending_count && i < SNAPSHOT_MAX_DROPS; ++i) {
+        __atomic_store_n(&snap->drops[i], pack_drop(&car->stops.pending[i], bits->lowest), __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&car->snapshot_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Function to read a consistent snapshot of a car without taking any lock.
+// Returns 0 on success, or -1 if the snapshot does not belong to the expected handle.
+int read_snapshot(car_info *car, registry_handle handle, car_snapshot *out) {
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&car->snapshot_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;  // Writer in progress; it only holds the sequence odd for a few stores
+        }
+
+        copy_snapshot(out, &car->snapshot);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&car->snapshot_seq, __ATOMIC_RELAXED) == seq) {
+            return out->handle == handle ? 0 : -1;
         }
-    } else {
-        free(message);  // Free memory for invalid messages
     }
+}
 
-    // Remove the car from service when done
-    remove_car_from_service(car);
-    return NULL;
+// Function to estimate (in ms) how long a car needs before it can leave its current position,
+// given how far through a door cycle it is. Never negative: a car between floors is already
+// free to carry on.
+int time_until_free(const car_snapshot *snap) {
+    int delay = snap->delay_ms;
+    switch (snap->status) {
+    case CAR_OPENING:
+        return delay / 2 + 2 * delay;  // Rest of opening, then open and closing
+    case CAR_OPEN:
+        return delay / 2 + delay;      // Rest of open, then closing
+    case CAR_CLOSING:
+        return delay / 2;
+    case CAR_BETWEEN:
+    case CAR_CLOSED:
+    default:
+        return 0;
+    }
+}
+
+// Function to get the level a car can next stop at: its current level when stopped, or the
+// level it is about to reach when travelling between floors
+int stopping_level(int current_level, int status, int direction) {
+    if (status == CAR_BETWEEN && direction != IDLE) {
+        return current_level + direction;
+    }
+    return current_level;
 }
 
-// Function to select the best car for a given call request
-car_info *select_best_car(call_request *call) {
-    car_info *best_car = NULL;
-    int min_distance = INT_MAX;
+// Function to estimate the time (in ms) a car takes to travel floors floors from one stop to
+// the next: its own motion profile if it announced one, otherwise its delay per floor
+int travel_time(const car_snapshot *snap, int floors) {
+    if (snap->motion.cruise_ms > 0) {
+        return (int)motion_trip_ms(&snap->motion, floors);
+    }
+    return floors * snap->delay_ms;
+}
 
-    pthread_mutex_lock(&data_mutex);  // Lock to protect car data
-    for (int i = 0; i < num_cars; ++i) {
-        car_info *car = &cars[i];
+// Function to estimate the time (in ms) until a car arrives at the call's source floor if the
+// call were added to its stop set. The car's stop set is replayed in service order (the same
+// LOOK order stop_bits_next() drives the real car in), with each pickup's drop-offs joining
+// once it is served: each leg costs its travel time and each stop a full door cycle (opening,
+// open, closing). A car with more pending pairs than its snapshot holds is assumed to stop
+// at all of its planned drop-offs.
+int estimate_pickup_eta(const car_snapshot *snap, int source, int dest) {
+    int delay = snap->delay_ms;
+    int door_cycle = 3 * delay;
+    int call_dir = dest > source ? STOPS_UP : STOPS_DOWN;
 
-        // Check if the car can service the request (based on floor range)
-        if (is_floor_in_range(call->source_floor, car->lowest_floor, car->highest_floor) &&
-            is_floor_in_range(call->dest_floor, car->lowest_floor, car->highest_floor)) {
+    stop_bits stops = snap->stops;
+    int s = source - stops.lowest;
+    if (call_dir == STOPS_UP) {
+        stops.up[s / 64] |= 1ULL << (s % 64);
+    } else {
+        stops.down[s / 64] |= 1ULL << (s % 64);
+    }
+    int drops = snap->pending_drops;
+    if (drops > SNAPSHOT_MAX_DROPS) {
+        for (int w = 0; w < STOP_SET_WORDS; ++w) {
+            stops.car[w] |= stops.planned[w];
+        }
+        drops = 0;
+    }
 
-            int distance = abs(compare_floors(car->current_floor, call->source_floor));
+    int direction = snap->direction;
+    int position = snap->current_level;
+    int from = stopping_level(position, snap->status, direction);
+    int eta = time_until_free(snap);
+    if (from != position) {
+        // Already half way to the next floor, so the first leg is half a floor shorter
+        eta -= (snap->motion.cruise_ms > 0 ? snap->motion.cruise_ms : delay) / 2;
+    }
 
-            // Select the closest car that is either idle or has no requests in its queue
-            if (distance < min_distance && (car->direction == IDLE || car->queue_head == NULL)) {
-                min_distance = distance;
-                best_car = car;
+    // Each iteration serves one stop, so the loop is bounded by the number of stops
+    for (int served = 0; served <= stops.levels * 2 + drops; ++served) {
+        int next = stop_bits_next(&stops, from, &direction);
+        if (next == STOP_NONE) {
+            break;
+        }
+        eta += travel_time(snap, abs(next - position));
+        position = next;
+        int boarded = stop_bits_arrive(&stops, next, &direction);
+        for (int i = 0; boarded && i < drops; ++i) {
+            // Passengers boarding here add their drop-offs, as they do on the real car
+            uint32_t drop = snap->drops[i];
+            int pickup = (int)(drop >> 16);
+            int travels = (drop & 1) ? STOPS_UP : STOPS_DOWN;
+            if (pickup == next - stops.lowest && (boarded & travels)) {
+                int d = (int)((drop >> 1) & 0x7fff);
+                stops.car[d / 64] |= 1ULL << (d % 64);
             }
         }
+        if (next == source && !stop_bits_test(&stops, call_dir, source)) {
+            break;  // The caller boards here
+        }
+        eta += door_cycle;
+        from = position;
     }
-    pthread_mutex_unlock(&data_mutex);
+    return eta < 0 ? 0 : eta;
+}
 
-    return best_car;
+// Function to hand a message for a car to its shared-memory link, if it has one. A full ring
+// means the car has stopped reading, so the car is dropped as for a full socket queue.
+// Returns 1 if the car is linked, otherwise 0.
+static int send_on_link(car_info *car, const char *message) {
+    if (!car->conn->link) {
+        return 0;
+    }
+    if (shm_ring_push(car->conn->link, &car->conn->link->to_car, message) != 0) {
+        shutdown(car->conn->sockfd, SHUT_RDWR);
+    }
+    return 1;
 }
 
-// Function to insert a call request into a car's queue
-void insert_into_queue(car_info *car, call_request *call) {
-    pthread_mutex_lock(&car->queue_mutex);  // Lock to protect the queue
-
-    Direction direction = car->direction;
-    if (direction == IDLE) {
-        // Determine the direction based on current and source floors
-        direction = compare_floors(car->current_floor, call->source_floor) < 0 ? UP : DOWN;
-        car->direction = direction;
-    }
-
-    // Create the request for the source floor
-    floor_request *from_request = malloc(sizeof(floor_request));
-    strncpy(from_request->floor, call->source_floor, sizeof(from_request->floor) - 1);
-    from_request->floor[sizeof(from_request->floor) - 1] = '\0';
-    from_request->direction = direction;
-    from_request->next = NULL;
-
-    // Create the request for the destination floor
-    floor_request *to_request = malloc(sizeof(floor_request));
-    strncpy(to_request->floor, call->dest_floor, sizeof(to_request->floor) - 1);
-    to_request->floor[sizeof(to_request->floor) - 1] = '\0';
-    to_request->direction = compare_floors(call->source_floor, call->dest_floor) < 0 ? UP : DOWN;
-    to_request->next = NULL;
-
-    // Insert the source and destination requests into the car's queue
-    floor_request **current = &car->queue_head;
-    floor_request *prev = NULL;
-    int inserted = 0;
-
-    while (*current) {
-        floor_request *req = *current;
-        int cmp = compare_floors(from_request->floor, req->floor);
-        if ((direction == UP && cmp < 0) || (direction == DOWN && cmp > 0)) {
-            from_request->next = req;
-            if (prev) {
-                prev->next = from_request;
-            } else {
-                car->queue_head = from_request;
+// Function to send an itinerary car its planned stops if they differ from what it already
+// has. A call at the floor whose doors are open is served by this stop, as the car will
+// drop an itinerary stop there. Must be called with car->queue_mutex held.
+void update_car_itinerary(car_info *car, int from) {
+    int status = parse_status(car->status);
+    if (status == CAR_OPENING || status == CAR_OPEN) {
+        stop_set_arrive(&car->stops, floor_to_level(car->current_floor));
+    }
+    car->target = stop_set_next(&car->stops, from);  // Also updates the sweep direction
+
+    int plan[ITINERARY_MAX_STOPS];
+    int count = stop_set_plan(&car->stops, from, plan, ITINERARY_MAX_STOPS);
+    if (count == car->itinerary_len && memcmp(plan, car->itinerary_stops, count * sizeof(int)) == 0) {
+        return;  // The car is already working through this
+    }
+    memcpy(car->itinerary_stops, plan, count * sizeof(int));
+    car->itinerary_len = count;
+    if (count > 0) {
+        level_to_floor(plan[0], car->destination_floor);
+    }
+
+    char message[16 + ITINERARY_MAX_STOPS * FLOOR_STR_SIZE];
+    int length = snprintf(message, sizeof(message), ITINERARY_TOKEN " %u", (unsigned int)++car->itinerary_version);
+    for (int i = 0; i < count; ++i) {
+        char floor[FLOOR_STR_SIZE];
+        level_to_floor(plan[i], floor);
+        length += snprintf(message + length, sizeof(message) - length, " %s", floor);
+    }
+    if (!send_on_link(car, message)) {
+        conn_send(car->conn, message, 1);  // A newer itinerary replaces one still queued
+    }
+}
+
+// Function to send the car towards its next stop if that has changed.
+// Must be called with car->queue_mutex held.
+void update_car_target(car_info *car) {
+    int level = floor_to_level(car->current_floor);
+    int from = stopping_level(level, parse_status(car->status), car->stops.direction);
+    if (car->itinerary) {
+        update_car_itinerary(car, from);
+        return;
+    }
+    int next = stop_set_next(&car->stops, from);
+
+    if (next == car->target) {
+        return;
+    }
+    car->target = next;
+    if (next == NO_TARGET) {
+        return;
+    }
+
+    level_to_floor(next, car->destination_floor);
+    char floor_msg[20];
+    snprintf(floor_msg, sizeof(floor_msg), "FLOOR %s", car->destination_floor);
+    if (send_on_link(car, floor_msg)) {
+        return;  // Same-host car: the FLOOR goes through shared memory
+    }
+    if (car->binary) {
+        unsigned char frame[BIN_FLOOR_SIZE];
+        encode_bin_floor(frame, ++car->tx_seq, floor_to_int(car->destination_floor));
+        conn_send_frame(car->conn, frame, sizeof(frame), 1);
+        return;
+    }
+    conn_send(car->conn, floor_msg, 1);  // Only the latest target matters to the car
+}
+
+// Function to register a car from its initial "CAR {name} {lowest} {highest} [BIN1]" message.
+// A car offering the binary protocol is answered with "PROTOCOL BIN1" and switched over. A car
+// offering SHM1 whose link segment can be mapped is answered with "PROTOCOL SHM1" instead and
+// exchanges STATUS and FLOOR through shared memory (see start_link()).
+// Returns the car's handle, or REGISTRY_NO_HANDLE if the message is invalid or the registry is full.
+registry_handle register_car(connection *conn, const char *message) {
+    char car_name[32], low_floor[FLOOR_STR_SIZE], high_floor[FLOOR_STR_SIZE];
+    int options_at = 0;
+    if (sscanf(message + 4, "%31s %3s %3s%n", car_name, low_floor, high_floor, &options_at) < 3 ||
+        !is_valid_floor(low_floor) || !is_valid_floor(high_floor) ||
+        compare_floors(low_floor, high_floor) > 0) {
+        return REGISTRY_NO_HANDLE;
+    }
+
+    // Optional extensions follow the floors: BIN1, SHM1, ITINERARY, MOTION <cruise> <accel> and
+    // HEARTBEAT <ms> (unknown ones are ignored)
+    int binary = 0;
+    int shm = 0;
+    int itinerary = 0;
+    int heartbeat_ms = 0;
+    motion_profile motion = { 0, 0 };
+    const char *option = message + 4 + options_at;
+    char token[16];
+    int used;
+    while (sscanf(option, "%15s%n", token, &used) == 1) {
+        option += used;
+        if (strcmp(token, BINARY_PROTOCOL) == 0) {
+            binary = 1;
+        } else if (strcmp(token, SHM_LINK_PROTOCOL) == 0) {
+            shm = 1;
+        } else if (strcmp(token, ITINERARY_TOKEN) == 0) {
+            itinerary = 1;
+        } else if (strcmp(token, MOTION_TOKEN) == 0) {
+            if (sscanf(option, "%d %d%n", &motion.cruise_ms, &motion.accel_ms, &used) != 2 ||
+                motion.cruise_ms <= 0 || motion.accel_ms < 0) {
+                return REGISTRY_NO_HANDLE;
             }
-            inserted = 1;
-            break;
+            option += used;
+        } else if (strcmp(token, HEARTBEAT_TOKEN) == 0) {
+            if (sscanf(option, "%d%n", &heartbeat_ms, &used) != 1 || heartbeat_ms <= 0) {
+                return REGISTRY_NO_HANDLE;
+            }
+            option += used;
         }
-        prev = req;
-        current = &req->next;
     }
 
-    // If not inserted, add it at the end of the queue
-    if (!inserted) {
-        if (prev) {
-            prev->next = from_request;
-        } else {
-            car->queue_head = from_request;
+    // The link only exists if the car runs on this host; otherwise carry on over the socket.
+    // Messages on the link are text, so binary frames are not needed as well.
+    char link_name[64];
+    shm_link *link = NULL;
+    if (shm && shm_link_name(car_name, link_name, sizeof(link_name)) == 0 && shm_link_open(link_name, &link) == 0) {
+        binary = 0;
+    }
+
+    registry_handle handle;
+    car_info *car = registry_alloc(&car_registry, &handle);
+    if (!car) {  // If the registry cannot grow any further
+        if (link) {
+            shm_link_close(link);
+        }
+        return REGISTRY_NO_HANDLE;
+    }
+
+    // Add the new car to the system
+    pthread_mutex_lock(&car->queue_mutex);
+    car->handle = handle;
+    car->conn = conn;
+    strncpy(car->name, car_name, sizeof(car->name) - 1);
+    car->name[sizeof(car->name) - 1] = '\0';
+    strncpy(car->lowest_floor, low_floor, sizeof(car->lowest_floor) - 1);
+    car->lowest_floor[sizeof(car->lowest_floor) - 1] = '\0';
+    strncpy(car->highest_floor, high_floor, sizeof(car->highest_floor) - 1);
+    car->highest_floor[sizeof(car->highest_floor) - 1] = '\0';
+    stop_set_init(&car->stops, floor_to_level(low_floor), floor_to_level(high_floor));
+    car->target = NO_TARGET;
+    car->itinerary = itinerary;
+    car->itinerary_version = 0;
+    car->itinerary_len = 0;
+    car->binary = binary;
+    car->tx_seq = 0;
+    car->rx_seen = 0;
+    if (car->binary) {
+        conn_send(conn, "PROTOCOL " BINARY_PROTOCOL, 0);  // Sent before any FLOOR can be
+    }
+    conn->link = link;  // Set before any FLOOR can be sent
+    if (link) {
+        conn_send(conn, "PROTOCOL " SHM_LINK_PROTOCOL, 0);
+    }
+
+    strncpy(car->status, "Closed", sizeof(car->status) - 1);
+    car->status[sizeof(car->status) - 1] = '\0';
+    strncpy(car->current_floor, low_floor, sizeof(car->current_floor) - 1);
+    car->current_floor[sizeof(car->current_floor) - 1] = '\0';
+    strncpy(car->destination_floor, low_floor, sizeof(car->destination_floor) - 1);
+    car->destination_floor[sizeof(car->destination_floor) - 1] = '\0';
+    car->delay_ms = DEFAULT_CAR_DELAY_MS;
+    car->motion = motion;
+    car->status_changed_ms = monotonic_ms();
+    publish_snapshot(car);  // Dispatch ignores the slot until this snapshot carries the new handle
+    pthread_mutex_unlock(&car->queue_mutex);
+
+    conn->heartbeat_ms = heartbeat_ms;  // The owning loop starts watching it after this message
+
+    return handle;
+}
+
+// Function to apply a validated status update to a car.
+// Must be called with car->queue_mutex held.
+void apply_car_status(car_info *car, const char *status, const char *current_floor, const char *destination_floor) {
+    // Learn the car's delay from how long each timed phase (door movement, open time, travel
+    // between floors) lasted. Idle time in Closed and back-to-back updates are not samples, and
+    // nor is travel for a car with a motion profile, whose floors take varying times.
+    if (strcmp(status, car->status) != 0 || strcmp(current_floor, car->current_floor) != 0) {
+        uint64_t now = monotonic_ms();
+        uint64_t sample = now - car->status_changed_ms;
+        car_status previous = parse_status(car->status);
+        if (previous != CAR_CLOSED && !(previous == CAR_BETWEEN && car->motion.cruise_ms > 0) &&
+            sample >= 1 && sample <= 10000) {
+            car->delay_ms = (3 * car->delay_ms + (int)sample) / 4;
         }
+        car->status_changed_ms = now;
     }
 
-    // Insert the destination request in the appropriate position
-    current = &from_request->next;
-    prev = from_request;
-    inserted = 0;
+    snprintf(car->status, sizeof(car->status), "%s", status);
+    snprintf(car->current_floor, sizeof(car->current_floor), "%s", current_floor);
+    snprintf(car->destination_floor, sizeof(car->destination_floor), "%s", destination_floor);
 
-    while (*current) {
-        floor_request *req = *current;
-        int cmp = compare_floors(to_request->floor, req->floor);
-        if ((to_request->direction == UP && cmp < 0) || (to_request->direction == DOWN && cmp > 0)) {
-            to_request->next = req;
-            prev->next = to_request;
-            inserted = 1;
-            break;
+    // Doors opening at a floor serve its stops; then head for whatever is next
+    car_status st = parse_status(car->status);
+    if (st == CAR_OPENING || st == CAR_OPEN) {
+        int level = floor_to_level(car->current_floor);
+        stop_set_arrive(&car->stops, level);
+        if (car->target == level) {
+            car->target = NO_TARGET;  // Reached; the next stop (even this level again) is new
+        }
+        if (car->itinerary_len > 0 && car->itinerary_stops[0] == level) {
+            // The car has dropped this stop from its itinerary too
+            memmove(car->itinerary_stops, car->itinerary_stops + 1, --car->itinerary_len * sizeof(int));
         }
-        prev = req;
-        current = &req->next;
+        update_car_target(car);
     }
 
-    // If not inserted, add it at the end of the queue
-    if (!inserted) {
-        prev->next = to_request;
+    publish_snapshot(car);
+}
+
+// Function to apply a "STATUS {status} {current} {destination}" update from a car
+void handle_car_status(car_info *car, const char *message) {
+    char status[16], current_floor[FLOOR_STR_SIZE], destination_floor[FLOOR_STR_SIZE];
+    if (sscanf(message + 7, "%15s %3s %3s", status, current_floor, destination_floor) != 3 ||
+        !is_valid_status(status) || !is_valid_floor(current_floor) || !is_valid_floor(destination_floor)) {
+        return;  // Ignore malformed updates rather than corrupting the car's state
     }
 
-    // If this is the first request, notify the car to go to the source floor
-    if (car->queue_head == from_request) {
-        char floor_msg[20];
-        snprintf(floor_msg, sizeof(floor_msg), "FLOOR %s", car->queue_head->floor);
-        send_message(car->sockfd, floor_msg);
-        strncpy(car->destination_floor, car->queue_head->floor, sizeof(car->destination_floor) - 1);
-        car->destination_floor[sizeof(car->destination_floor) - 1] = '\0';
+    pthread_mutex_lock(&car->queue_mutex);
+    apply_car_status(car, status, current_floor, destination_floor);
+    pthread_mutex_unlock(&car->queue_mutex);
+}
+
+// Function to apply a binary STATUS frame from a car that negotiated the binary protocol.
+// Frames older than the last one applied (by sequence number) are ignored.
+void handle_car_bin_status(car_info *car, const char *frame, size_t len) {
+    int status, current, destination;
+    uint16_t seq;
+    char current_floor[FLOOR_STR_SIZE], destination_floor[FLOOR_STR_SIZE];
+    if (decode_bin_status(frame, len, &status, &seq, &current, &destination) != 0 ||
+        current == 0 || destination == 0 || current < -99 || current > 999 ||
+        destination < -99 || destination > 999) {
+        return;
     }
+    int_to_floor(current, current_floor);
+    int_to_floor(destination, destination_floor);
 
+    pthread_mutex_lock(&car->queue_mutex);
+    if (!car->rx_seen || (int16_t)(seq - car->rx_seq) > 0) {
+        car->rx_seen = 1;
+        car->rx_seq = seq;
+        apply_car_status(car, status_name(status), current_floor, destination_floor);
+    }
     pthread_mutex_unlock(&car->queue_mutex);
 }
 
-// Thread function to handle call requests from clients
-void *handle_call(void *arg) {
-    client_arg_t *call_arg = (client_arg_t *)arg;  // Cast the argument to the expected type
-    int sockfd = call_arg->sockfd;
-    char *message = call_arg->message;
-    free(arg);
+// Function to score a car for a call in destination-dispatch mode (lower is better).
+// Every stop the call adds costs the other passengers a door cycle, so a car already stopping
+// at the caller's destination (or close to it) is preferred to one that would add a new stop.
+// Returns -1 if taking the call would push the car past DD_MAX_TRIP_STOPS drop-offs.
+int destination_dispatch_cost(const car_snapshot *snap, int source, int dest, int eta) {
+    int door_cycle = 3 * snap->delay_ms;
+    int hall = dest > source ? STOPS_UP : STOPS_DOWN;
+    int cost = eta;
+
+    if (!stop_bits_test(&snap->stops, hall, source)) {
+        cost += door_cycle;  // New pickup stop
+    }
+
+    int drop_offs = STOPS_CAR | STOPS_PLANNED;
+    if (!stop_bits_test(&snap->stops, drop_offs, dest)) {
+        if (stop_bits_count(&snap->stops, drop_offs) >= DD_MAX_TRIP_STOPS) {
+            return -1;
+        }
+        // A new drop-off near an existing one costs half: the passengers share most of the trip
+        int nearby = 0;
+        for (int d = 1; d <= DD_NEARBY_LEVELS && !nearby; ++d) {
+            nearby = stop_bits_test(&snap->stops, drop_offs, dest - d) ||
+                     stop_bits_test(&snap->stops, drop_offs, dest + d);
+        }
+        cost += nearby ? door_cycle / 2 : door_cycle;
+    }
+    return cost;
+}
+
+// Function to score how well a car suits a call (lower is better): its estimated time of
+// arrival, plus the cost of the stops the call adds in destination-dispatch mode, where a car
+// whose trip is full scores worse than every car that is not.
+// Returns -1 if the call is outside the car's floor range.
+int score_car(const car_snapshot *snap, int source, int dest) {
+    if (source < snap->lowest_level || source > snap->highest_level ||
+        dest < snap->lowest_level || dest > snap->highest_level) {
+        return -1;
+    }
+
+    int eta = estimate_pickup_eta(snap, source, dest);
+    if (destination_dispatch) {
+        int cost = destination_dispatch_cost(snap, source, dest, eta);
+        return cost < 0 ? DD_FULL_PENALTY + eta : cost;
+    }
+    return eta;
+}
+
+// Function to select the best car for a given call request.
+// Reads each car's published snapshot, so scoring never blocks on (or stalls) car sessions, and
+// picks the car with the lowest estimated time of arrival at the caller's floor. Busy cars are
+// eligible too: one already heading the right way often arrives sooner than an idle one.
+// Returns the chosen car's handle, or REGISTRY_NO_HANDLE if no car can take the call.
+registry_handle select_best_car(call_request *call) {
+    registry_handle best_car = REGISTRY_NO_HANDLE;
+    int best_score = INT_MAX;
+    int best_stops = INT_MAX;
+    int source = floor_to_level(call->source_floor);
+    int dest = floor_to_level(call->dest_floor);
 
-    // Process the call request
-    if (strncmp(message, "CALL ", 5) == 0) {
-        char source_floor[FLOOR_STR_SIZE], dest_floor[FLOOR_STR_SIZE];
-        if (sscanf(message + 5, "%11s %11s", source_floor, dest_floor) != 2) {
-            send_message(sockfd, "UNAVAILABLE");
-            free(message);
-            close(sockfd);
-            return NULL;
+    uint32_t capacity = registry_capacity(&car_registry);
+    for (uint32_t i = 0; i < capacity; ++i) {
+        registry_handle handle;
+        car_snapshot snap;
+        car_info *car = registry_slot_record(&car_registry, i, &handle);
+        if (!car || read_snapshot(car, handle, &snap) != 0) {
+            continue;  // Free slot, or a car that is still being registered
         }
 
-        if (!is_valid_floor(source_floor) || !is_valid_floor(dest_floor)) {
-            send_message(sockfd, "UNAVAILABLE");
-            free(message);
-            close(sockfd);
-            return NULL;
+        int score = score_car(&snap, source, dest);
+        if (score < 0) {
+            continue;  // The car cannot reach one of the floors
         }
 
-        // Determine the direction of the call
-        Direction dir = (compare_floors(source_floor, dest_floor) < 0) ? UP : DOWN;
+        // Lowest score wins; ties go to the car with fewer pending stops
+        if (score < best_score || (score == best_score && snap.pending_stops < best_stops)) {
+            best_score = score;
+            best_stops = snap.pending_stops;
+            best_car = handle;
+        }
+    }
 
-        call_request call;
-        strncpy(call.source_floor, source_floor, sizeof(call.source_floor) - 1);
-        call.source_floor[sizeof(call.source_floor) - 1] = '\0';
-        strncpy(call.dest_floor, dest_floor, sizeof(call.dest_floor) - 1);
-        call.dest_floor[sizeof(call.dest_floor) - 1] = '\0';
-        call.direction = dir;
-
-        // Select the best car for the call
-        car_info *selected_car = select_best_car(&call);
-
-        if (selected_car) {
-            // Insert the call into the selected car's queue
-            insert_into_queue(selected_car, &call);
-
-            // Send a response to the client with the car name
-            char response[64];
-            snprintf(response, sizeof(response), "CAR %s", selected_car->name);
-            send_message(sockfd, response);
+    return best_car;
+}
+
+// Function to add a call to a car's stop set. Must be called with the car's queue_mutex held.
+void queue_call_locked(car_info *car, call_request *call) {
+    int source = floor_to_level(call->source_floor);
+    stop_set_add_call(&car->stops, source, floor_to_level(call->dest_floor));
+
+    // A caller at a floor where the doors are already open boards straight away
+    car_status st = parse_status(car->status);
+    if ((st == CAR_OPENING || st == CAR_OPEN) && floor_to_level(car->current_floor) == source) {
+        stop_set_arrive(&car->stops, source);
+    }
+}
+
+// Function to add a call to a car's stop set, copying the car's name into car_name.
+// Returns 0 on success or -1 if the car left service after it was selected.
+int insert_into_queue(registry_handle handle, call_request *call, char *car_name, size_t name_size) {
+    car_info *car = registry_get(&car_registry, handle);
+    if (!car) {
+        return -1;
+    }
+    pthread_mutex_lock(&car->queue_mutex);  // Lock to protect the stop set
+    if (!registry_is_live(&car_registry, handle)) {
+        pthread_mutex_unlock(&car->queue_mutex);  // Removed while we waited for the lock
+        return -1;
+    }
+    snprintf(car_name, name_size, "%s", car->name);
+
+    queue_call_locked(car, call);
+    update_car_target(car);
+
+    publish_snapshot(car);
+    pthread_mutex_unlock(&car->queue_mutex);
+    return 0;
+}
+
+// Function to add every call in a group to a car's stop set under one hold of its lock, so a
+// car leaving service takes either none of the group or all of it (and re-dispatches it).
+// Copies the car's name into car_name. Returns 0 on success or -1 if the car left service.
+int insert_group_into_queue(registry_handle handle, call_group *group, char *car_name, size_t name_size) {
+    car_info *car = registry_get(&car_registry, handle);
+    if (!car) {
+        return -1;
+    }
+    pthread_mutex_lock(&car->queue_mutex);
+    if (!registry_is_live(&car_registry, handle)) {
+        pthread_mutex_unlock(&car->queue_mutex);
+        return -1;
+    }
+    snprintf(car_name, name_size, "%s", car->name);
+
+    // Identical calls merge into the same stop bits, so each caller is simply added in turn
+    for (call_waiter *w = group->waiters; w; w = w->next) {
+        queue_call_locked(car, &w->call);
+    }
+    update_car_target(car);
+
+    publish_snapshot(car);
+    pthread_mutex_unlock(&car->queue_mutex);
+    return 0;
+}
+
+// Function to send the answer for a call back to the caller.
+// Tagged calls (from persistent call sessions) echo the caller's request ID.
+void reply_to_call(connection *conn, int tagged, unsigned int tag, const char *car_name) {
+    char response[64];
+    if (tagged) {
+        if (car_name) {
+            snprintf(response, sizeof(response), "CAR %u %s", tag, car_name);
         } else {
-            send_message(sockfd, "UNAVAILABLE");  // No available car
+            snprintf(response, sizeof(response), "UNAVAILABLE %u", tag);
         }
     } else {
-        send_message(sockfd, "UNAVAILABLE");  // Invalid message format
+        if (car_name) {
+            snprintf(response, sizeof(response), "CAR %s", car_name);
+        } else {
+            snprintf(response, sizeof(response), "UNAVAILABLE");
+        }
     }
+    conn_send(conn, response, 0);
+}
 
-    free(message);
-    close(sockfd);
-    return NULL;
+// Function to parse a call message, either "CALL {source} {destination}" or the tagged
+// session form "CALL {id} {source} {destination}". Returns 0 on success, or -1 if the call is
+// malformed or its source and destination are the same floor.
+int parse_call(const char *message, call_request *call, int *tagged, unsigned int *tag) {
+    char source_floor[FLOOR_STR_SIZE], dest_floor[FLOOR_STR_SIZE];
+    int consumed = 0;
+
+    *tagged = 0;
+    *tag = 0;
+    if (sscanf(message + 5, "%u %3s %3s%n", tag, source_floor, dest_floor, &consumed) == 3 &&
+        message[5 + consumed] == '\0') {
+        *tagged = 1;
+    } else if (sscanf(message + 5, "%3s %3s%n", source_floor, dest_floor, &consumed) != 2 ||
+               message[5 + consumed] != '\0') {
+        return -1;
+    }
+
+    if (!is_valid_floor(source_floor) || !is_valid_floor(dest_floor)) {
+        return -1;
+    }
+    if (compare_floors(source_floor, dest_floor) == 0) {
+        return -1;  // No car can serve a trip to the floor the caller is already on
+    }
+
+    // Determine the direction of the call
+    strncpy(call->source_floor, source_floor, sizeof(call->source_floor) - 1);
+    call->source_floor[sizeof(call->source_floor) - 1] = '\0';
+    strncpy(call->dest_floor, dest_floor, sizeof(call->dest_floor) - 1);
+    call->dest_floor[sizeof(call->dest_floor) - 1] = '\0';
+    call->direction = (compare_floors(source_floor, dest_floor) < 0) ? UP : DOWN;
+    return 0;
 }
 
-// Main controller loop that listens for incoming connections (either cars or calls)
-void run_controller() {
-    int listen_sock;
-    struct sockaddr_in serv_addr;
-    int opt_enable = 1;
+// Function to add a call to the preferred car, or to the best available car if there is no
+// preference or the preferred car has left service. Copies the car's name into car_name.
+// Returns the car's handle, or REGISTRY_NO_HANDLE if no car can take the call.
+registry_handle place_call(call_request *call, registry_handle preferred, char *car_name, size_t name_size) {
+    registry_handle car = preferred != REGISTRY_NO_HANDLE ? preferred : select_best_car(call);
 
-    // Create a TCP socket for listening
-    listen_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_sock == -1) {
-        perror("socket");
-        exit(EXIT_FAILURE);
+    // If the car leaves service before the call can be queued, pick again
+    while (car != REGISTRY_NO_HANDLE) {
+        if (insert_into_queue(car, call, car_name, name_size) == 0) {
+            return car;
+        }
+        car = select_best_car(call);
     }
+    return REGISTRY_NO_HANDLE;
+}
 
-    // Set socket options to allow address reuse
-    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt_enable, sizeof(opt_enable));
+// Function to dispatch a parsed call to the best car and reply to the caller
+void dispatch_call(connection *conn, call_request *call, int tagged, unsigned int tag) {
+    char car_name[32];
+    registry_handle car = place_call(call, REGISTRY_NO_HANDLE, car_name, sizeof(car_name));
+    reply_to_call(conn, tagged, tag, car != REGISTRY_NO_HANDLE ? car_name : NULL);
+}
 
-    // Configure server address structure
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = inet_addr(CONTROLLER_IP);
-    serv_addr.sin_port = htons(CONTROLLER_PORT);
+// Function to assign every call in a group to one car (the preferred one if it is still in
+// service) and answer all of its callers.
+// Must be called with coalesce_mutex held, which keeps the waiting connections open.
+void dispatch_group(call_group *group, registry_handle preferred) {
+    char car_name[32];
+    const char *answer = NULL;
+    registry_handle selected_car = preferred != REGISTRY_NO_HANDLE ? preferred : select_best_car(&group->span);
 
-    // Bind the socket to the address and port
-    if (bind(listen_sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) != 0) {
-        perror("bind");
-        close(listen_sock);
-        exit(EXIT_FAILURE);
+    while (selected_car != REGISTRY_NO_HANDLE) {
+        if (insert_group_into_queue(selected_car, group, car_name, sizeof(car_name)) == 0) {
+            answer = car_name;
+            break;
+        }
+        // The car left service before any of the group was queued, so pick again
+        selected_car = select_best_car(&group->span);
     }
 
-    // Start listening for incoming connections
-    if (listen(listen_sock, 5) != 0) {
-        perror("listen");
-        close(listen_sock);
-        exit(EXIT_FAILURE);
+    while (group->waiters) {
+        call_waiter *w = group->waiters;
+        group->waiters = w->next;
+        reply_to_call(w->conn, w->tagged, w->tag, answer);
+
+        // Session calls stay open for reassignment until their pickup is served
+        call_assignment *a = (reassign_calls && answer && w->tagged) ? malloc(sizeof(call_assignment)) : NULL;
+        if (a) {
+            a->conn = w->conn;  // Still counted in conn->waiting
+            a->tag = w->tag;
+            a->call = w->call;
+            a->car = selected_car;
+            a->next = open_assignments;
+            open_assignments = a;
+        } else if (--w->conn->waiting == 0 && w->conn->kind == CONN_CALL) {
+            // One-shot call answered: close once the reply is out.
+            // The owning loop only frees the connection after taking coalesce_mutex.
+            conn_finish(w->conn);
+        }
+        free(w);
     }
+    free(group);
+}
 
-    // Main loop to accept and handle incoming connections
-    while (keep_running) {
-        int *new_sock = malloc(sizeof(int));  // Allocate memory for new socket
-        *new_sock = accept(listen_sock, NULL, NULL);  // Accept a new connection
-        if (*new_sock == -1) {
-            if (errno == EINTR) {  // Handle interrupted system call (e.g., by SIGINT)
-                free(new_sock);
-                break;
+// Function to move an open session call to another car and tell the caller.
+// Must be called with coalesce_mutex held.
+void move_assignment(call_assignment *a, registry_handle to) {
+    int source = floor_to_level(a->call.source_floor);
+    int dest = floor_to_level(a->call.dest_floor);
+
+    car_info *old = registry_get(&car_registry, a->car);
+    if (old) {
+        pthread_mutex_lock(&old->queue_mutex);
+        if (registry_is_live(&car_registry, a->car)) {
+            if (stop_set_remove_call(&old->stops, source, dest) != 0) {
+                pthread_mutex_unlock(&old->queue_mutex);
+                return;  // The passenger boarded in the meantime
             }
-            perror("accept");
-            free(new_sock);
-            continue;
+            update_car_target(old);
+            publish_snapshot(old);
+        }
+        pthread_mutex_unlock(&old->queue_mutex);
+    }
+
+    char car_name[32];
+    a->car = place_call(&a->call, to, car_name, sizeof(car_name));
+    reply_to_call(a->conn, 1, a->tag, a->car != REGISTRY_NO_HANDLE ? car_name : NULL);
+}
+
+// Function to drop open session calls that no longer need tracking: their pickup has been
+// served or their car has left service. Must be called with coalesce_mutex held.
+void prune_assignments(void) {
+    call_assignment **link = &open_assignments;
+    while (*link) {
+        call_assignment *a = *link;
+        int open = 0;
+        car_info *car = registry_get(&car_registry, a->car);
+        if (car) {
+            pthread_mutex_lock(&car->queue_mutex);
+            open = registry_is_live(&car_registry, a->car) &&
+                   stop_set_is_pending(&car->stops, floor_to_level(a->call.source_floor),
+                                       floor_to_level(a->call.dest_floor));
+            pthread_mutex_unlock(&car->queue_mutex);
+        }
+        if (open) {
+            link = &a->next;
+        } else {
+            *link = a->next;
+            a->conn->waiting--;
+            free(a);
         }
+    }
+}
+
+// A car that could take at least one call of a batch
+typedef struct {
+    registry_handle handle;
+    int best;                         // Its lowest score over the batch's calls
+    int needed;                       // Whether it is the best car for some call
+} batch_candidate;
+
+// Order for choosing batch cars: the best car for some call first, then by lowest score
+static int compare_candidates(const void *a, const void *b) {
+    const batch_candidate *x = a, *y = b;
+    if (x->needed != y->needed) {
+        return y->needed - x->needed;
+    }
+    return (x->best > y->best) - (x->best < y->best);
+}
 
-        // Receive the initial message from the client (either a car or call request)
-        char *message = NULL;
-        if (receive_message(*new_sock, &message) != 0) {
-            close(*new_sock);
-            free(new_sock);
+// Function to choose the cars a batch is matched over. Every car in service is scored against
+// the batch's calls; the best car for each call is always chosen, and the remaining places up
+// to BATCH_MAX_CARS go to the cars with the lowest score for any call. Stores their handles
+// and snapshots in cars and snaps and returns how many were chosen.
+int choose_batch_cars(call_request **calls, int nrows, registry_handle *cars, car_snapshot *snaps) {
+    uint32_t capacity = registry_capacity(&car_registry);
+    batch_candidate *candidates = malloc(capacity * sizeof(batch_candidate));
+    if (!candidates) {
+        return 0;
+    }
+
+    int row_best[BATCH_MAX_ROWS], row_best_score[BATCH_MAX_ROWS];
+    for (int r = 0; r < nrows; ++r) {
+        row_best[r] = -1;
+    }
+    int count = 0;
+    for (uint32_t i = 0; i < capacity; ++i) {
+        registry_handle handle;
+        car_info *car = registry_slot_record(&car_registry, i, &handle);
+        if (!car || read_snapshot(car, handle, &snaps[0]) != 0) {
             continue;
         }
+        int best = INT_MAX;
+        for (int r = 0; r < nrows; ++r) {
+            int score = score_car(&snaps[0], floor_to_level(calls[r]->source_floor), floor_to_level(calls[r]->dest_floor));
+            if (score < 0) {
+                continue;
+            }
+            if (score < best) {
+                best = score;
+            }
+            if (row_best[r] < 0 || score < row_best_score[r]) {
+                row_best[r] = count;
+                row_best_score[r] = score;
+            }
+        }
+        if (best == INT_MAX) {
+            continue;  // Can take none of the calls
+        }
+        candidates[count].handle = handle;
+        candidates[count].best = best;
+        candidates[count].needed = 0;
+        count++;
+    }
+    for (int r = 0; r < nrows; ++r) {
+        if (row_best[r] >= 0) {
+            candidates[row_best[r]].needed = 1;
+        }
+    }
+    if (count > BATCH_MAX_CARS) {
+        qsort(candidates, count, sizeof(batch_candidate), compare_candidates);
+        count = BATCH_MAX_CARS;  // At most BATCH_MAX_ROWS cars are needed, so all of them fit
+    }
 
-        // If the message is from a car, handle it in a new thread
-        if (strncmp(message, "CAR ", 4) == 0) {
-            client_arg_t *car_arg = malloc(sizeof(client_arg_t));
-            car_arg->sockfd = *new_sock;
-            car_arg->message = message;
-            pthread_t car_thread;
-            pthread_create(&car_thread, NULL, handle_car, car_arg);
-            pthread_detach(car_thread);
-            free(new_sock);
-        } 
-        // If the message is a call request, handle it in a new thread
-        else if (strncmp(message, "CALL ", 5) == 0) {
-            client_arg_t *call_arg = malloc(sizeof(client_arg_t));
-            call_arg->sockfd = *new_sock;
-            call_arg->message = message;
-            pthread_t call_thread;
-            pthread_create(&call_thread, NULL, handle_call, call_arg);
-            pthread_detach(call_thread);
-            free(new_sock);
-        } 
-        // If the message format is invalid, close the connection
-        else {
-            close(*new_sock);
-            free(new_sock);
-            free(message);
-        }
-    }
-    close(listen_sock);  // Close the listening socket when done
+    // Take fresh snapshots of the chosen cars (some may have left service meanwhile)
+    int ncars = 0;
+    for (int k = 0; k < count; ++k) {
+        car_info *car = registry_get(&car_registry, candidates[k].handle);
+        if (car && read_snapshot(car, candidates[k].handle, &snaps[ncars]) == 0) {
+            cars[ncars++] = candidates[k].handle;
+        }
+    }
+    free(candidates);
+    return ncars;
 }
 
-int main(int argc, char *argv[]) {
-    (void)argc;
-    (void)argv;
+// Function to assign a batch of call groups (and, with reassignment, the open session calls)
+// to cars by min-cost matching over their scores. Each car is offered as several slots, the
+// later ones costing a door cycle more, so one car can take several calls in a busy batch.
+// Must be called with coalesce_mutex held; takes ownership of the groups.
+void dispatch_batch(call_group *groups) {
+    registry_handle cars[BATCH_MAX_CARS];
+    call_group *row_group[BATCH_MAX_ROWS];
+    call_assignment *row_assign[BATCH_MAX_ROWS];
+    int ncars = 0, nrows = 0;
+
+    while (groups && nrows < BATCH_MAX_ROWS) {
+        row_group[nrows] = groups;
+        row_assign[nrows++] = NULL;
+        groups = groups->next;
+    }
+    if (reassign_calls) {
+        prune_assignments();
+        for (call_assignment *a = open_assignments; a && nrows < BATCH_MAX_ROWS; a = a->next) {
+            row_group[nrows] = NULL;
+            row_assign[nrows++] = a;
+        }
+    }
+
+    call_request *row_call[BATCH_MAX_ROWS];
+    for (int r = 0; r < nrows; ++r) {
+        row_call[r] = row_group[r] ? &row_group[r]->span : &row_assign[r]->call;
+    }
+    car_snapshot *snaps = malloc(BATCH_MAX_CARS * sizeof(car_snapshot));
+    if (snaps) {
+        ncars = choose_batch_cars(row_call, nrows, cars, snaps);
+    }
+
+    int slots = ncars > 0 ? (nrows + ncars - 1) / ncars : 0;
+    int cols = ncars * slots;
+    int64_t *cost = ncars > 0 ? malloc((size_t)nrows * cols * sizeof(int64_t)) : NULL;
+    int *row_to_col = malloc(BATCH_MAX_ROWS * sizeof(int));
+
+    int solved = 0;
+    if (cost && row_to_col) {
+        for (int r = 0; r < nrows; ++r) {
+            int source = floor_to_level(row_call[r]->source_floor);
+            int dest = floor_to_level(row_call[r]->dest_floor);
+            for (int k = 0; k < ncars; ++k) {
+                int score = score_car(&snaps[k], source, dest);
+                int door_cycle = 3 * snaps[k].delay_ms;
+                // Moving an open call must gain more than a door cycle, so plans do not churn
+                int move = (row_assign[r] && row_assign[r]->car != cars[k]) ? door_cycle : 0;
+                for (int j = 0; j < slots; ++j) {
+                    cost[(size_t)r * cols + k * slots + j] =
+                        score < 0 ? ASSIGNMENT_INFEASIBLE : (int64_t)score + j * door_cycle + move;
+                }
+            }
+        }
+        solved = assignment_solve(nrows, cols, cost, row_to_col) == 0;
+    }
+
+    for (int r = 0; r < nrows; ++r) {
+        registry_handle car = REGISTRY_NO_HANDLE;
+        if (solved && cost[(size_t)r * cols + row_to_col[r]] < ASSIGNMENT_INFEASIBLE) {
+            car = cars[row_to_col[r] / slots];
+        }
+        if (row_group[r]) {
+            dispatch_group(row_group[r], car);  // Falls back to greedy selection if car is unset
+        } else if (car != REGISTRY_NO_HANDLE && car != row_assign[r]->car) {
+            move_assignment(row_assign[r], car);
+        }
+    }
+
+    // Anything beyond the batch size is assigned greedily
+    while (groups) {
+        call_group *group = groups;
+        groups = groups->next;
+        dispatch_group(group, REGISTRY_NO_HANDLE);
+    }
+
+    free(cost);
+    free(row_to_col);
+    free(snaps);
+}
+
+// Function to dispatch every coalescing group whose window has closed
+void flush_coalesced_calls(void) {
+    uint64_t now = monotonic_ms();
+    pthread_mutex_lock(&coalesce_mutex);
+    if (batch_horizon_ms > 0) {
+        // The horizon of the oldest call has passed: solve everything collected so far together
+        if (coalesce_head && coalesce_head->deadline_ms <= now) {
+            call_group *groups = coalesce_head;
+            coalesce_head = NULL;
+            coalesce_tail = &coalesce_head;
+            dispatch_batch(groups);
+        }
+        pthread_mutex_unlock(&coalesce_mutex);
+        return;
+    }
+    while (coalesce_head && coalesce_head->deadline_ms <= now) {
+        call_group *group = coalesce_head;
+        coalesce_head = group->next;
+        if (!coalesce_head) {
+            coalesce_tail = &coalesce_head;
+        }
+        dispatch_group(group, REGISTRY_NO_HANDLE);
+    }
+    pthread_mutex_unlock(&coalesce_mutex);
+}
+
+// Function to get how long an event loop may sleep before the next group is due (-1 if none)
+int coalesce_timeout_ms(void) {
+    int timeout = -1;
+    pthread_mutex_lock(&coalesce_mutex);
+    if (coalesce_head) {
+        uint64_t now = monotonic_ms();
+        timeout = coalesce_head->deadline_ms > now ? (int)(coalesce_head->deadline_ms - now) : 0;
+    }
+    pthread_mutex_unlock(&coalesce_mutex);
+    return timeout;
+}
+
+// Function to add a call to the pending group for its floor and direction, opening a new
+// group (and window) if there is none. Returns 0 if the call was queued, -1 if it must be
+// dispatched straight away.
+int coalesce_call(connection *conn, call_request *call, int tagged, unsigned int tag) {
+    call_waiter *waiter = malloc(sizeof(call_waiter));
+    if (!waiter) {
+        return -1;
+    }
+    waiter->conn = conn;
+    waiter->tagged = tagged;
+    waiter->tag = tag;
+    waiter->call = *call;
+    waiter->next = NULL;
+
+    int source = floor_to_level(call->source_floor);
+    pthread_mutex_lock(&coalesce_mutex);
+
+    call_group *group;
+    for (group = coalesce_head; group; group = group->next) {
+        if (group->source == source && group->direction == call->direction &&
+            (!destination_dispatch || abs(floor_to_level(group->waiters->call.dest_floor) -
+                                          floor_to_level(call->dest_floor)) <= DD_NEARBY_LEVELS)) {
+            break;  // In destination-dispatch mode only nearby destinations share a car
+        }
+    }
+
+    if (!group) {
+        group = malloc(sizeof(call_group));
+        if (!group) {
+            pthread_mutex_unlock(&coalesce_mutex);
+            free(waiter);
+            return -1;
+        }
+        group->source = source;
+        group->direction = call->direction;
+        group->span = *call;
+        group->deadline_ms = monotonic_ms() + coalesce_window_ms;
+        group->waiters = NULL;
+        group->tail = &group->waiters;
+        group->next = NULL;
+        *coalesce_tail = group;  // Fixed window, so appending keeps the list in deadline order
+        coalesce_tail = &group->next;
+    } else if (compare_floors(call->dest_floor, group->span.dest_floor) * call->direction > 0) {
+        group->span = *call;  // The chosen car must also reach this farther destination
+    }
+
+    *group->tail = waiter;
+    group->tail = &waiter->next;
+    conn->waiting++;
+    pthread_mutex_unlock(&coalesce_mutex);
+    return 0;
+}
+
+// Function to drop every coalesced or open call waiting on a connection that is being closed
+void cancel_coalesced_calls(connection *conn) {
+    pthread_mutex_lock(&coalesce_mutex);
+    call_group **link = &coalesce_head;
+    coalesce_tail = &coalesce_head;
+    while (conn->waiting > 0 && *link) {
+        call_group *group = *link;
+
+        call_waiter **w = &group->waiters;
+        group->tail = &group->waiters;
+        while (*w) {
+            if ((*w)->conn == conn) {
+                call_waiter *gone = *w;
+                *w = gone->next;
+                free(gone);
+                conn->waiting--;
+            } else {
+                group->tail = &(*w)->next;
+                w = &(*w)->next;
+            }
+        }
+
+        // The other callers still need an answer, so only unlink groups that are now empty
+        if (!group->waiters) {
+            *link = group->next;
+            free(group);
+        } else {
+            coalesce_tail = &group->next;
+            link = &group->next;
+        }
+    }
+    // Stopped early: the rest of the list is untouched, so find its end
+    while (*coalesce_tail) {
+        coalesce_tail = &(*coalesce_tail)->next;
+    }
+
+    // Session calls kept open for reassignment
+    for (call_assignment **a = &open_assignments; conn->waiting > 0 && *a;) {
+        if ((*a)->conn == conn) {
+            call_assignment *gone = *a;
+            *a = gone->next;
+            free(gone);
+            conn->waiting--;
+        } else {
+            a = &(*a)->next;
+        }
+    }
+    pthread_mutex_unlock(&coalesce_mutex);
+}
+
+// Function to fill in a call request from source and destination levels
+void call_from_levels(call_request *call, int source, int dest) {
+    level_to_floor(source, call->source_floor);
+    level_to_floor(dest, call->dest_floor);
+    call->direction = dest > source ? UP : DOWN;
+}
+
+// Function to estimate the pickup time of a call on the car it was just placed with
+int placed_pickup_eta(registry_handle handle, int source, int dest) {
+    car_snapshot snap;
+    car_info *car = registry_get(&car_registry, handle);
+    if (!car || read_snapshot(car, handle, &snap) != 0) {
+        return 0;
+    }
+    return estimate_pickup_eta(&snap, source, dest);
+}
+
+// Function to record one orphaned call that was placed (or could not be placed) on another car
+void count_reassignment(registry_handle placed, int old_eta, int source, int dest) {
+    if (placed == REGISTRY_NO_HANDLE) {
+        __atomic_add_fetch(&stat_unplaced, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    int new_eta = placed_pickup_eta(placed, source, dest);
+    __atomic_add_fetch(&stat_reassigned, 1, __ATOMIC_RELAXED);
+    if (new_eta > old_eta) {
+        __atomic_add_fetch(&stat_added_ms, (uint64_t)(new_eta - old_eta), __ATOMIC_RELAXED);
+    }
+}
+
+// Function to hand the pickups a car can no longer serve to the remaining cars through the
+// normal selection path. old_snap is the car's last published state (NULL if unknown), used to
+// estimate how much later the passengers will now be picked up.
+void redispatch_orphans(registry_handle from, const car_snapshot *old_snap, pending_drop *orphans, int count) {
+    char car_name[32];
+
+    // Open session calls are told which car is coming instead
+    if (reassign_calls) {
+        pthread_mutex_lock(&coalesce_mutex);
+        for (call_assignment *a = open_assignments; a; a = a->next) {
+            if (a->car != from) {
+                continue;
+            }
+            int source = floor_to_level(a->call.source_floor);
+            int dest = floor_to_level(a->call.dest_floor);
+            for (int i = 0; i < count; ++i) {
+                if (orphans[i].pickup == source && orphans[i].dest == dest && orphans[i].callers > 0) {
+                    orphans[i].callers--;  // Placed here rather than below
+                    int old_eta = old_snap ? estimate_pickup_eta(old_snap, source, dest) : 0;
+                    a->car = place_call(&a->call, REGISTRY_NO_HANDLE, car_name, sizeof(car_name));
+                    reply_to_call(a->conn, 1, a->tag, a->car != REGISTRY_NO_HANDLE ? car_name : NULL);
+                    count_reassignment(a->car, old_eta, source, dest);
+                    break;
+                }
+            }
+        }
+        pthread_mutex_unlock(&coalesce_mutex);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        call_request call;
+        call_from_levels(&call, orphans[i].pickup, orphans[i].dest);
+        int old_eta = old_snap ? estimate_pickup_eta(old_snap, orphans[i].pickup, orphans[i].dest) : 0;
+        for (int c = 0; c < orphans[i].callers; ++c) {
+            registry_handle placed = place_call(&call, REGISTRY_NO_HANDLE, car_name, sizeof(car_name));
+            count_reassignment(placed, old_eta, orphans[i].pickup, orphans[i].dest);
+        }
+    }
+}
+
+// Function to remove a car from service (called when a car goes into emergency or individual
+// service mode, or disconnects). Pickups it had accepted are re-dispatched to other cars;
+// drop-offs for passengers already aboard stay with the car and are only counted.
+void remove_car_from_service(registry_handle handle) {
+    car_info *car = registry_get(&car_registry, handle);
+    if (!car) {
+        return;
+    }
+
+    car_snapshot snap;
+    int have_snap = read_snapshot(car, handle, &snap) == 0;
+    pending_drop *orphans = NULL;
+    int count = 0;
+
+    // Drop the car's stops and retire its handle under the queue lock,
+    // so a concurrent insert either completes first or sees the stale handle
+    pthread_mutex_lock(&car->queue_mutex);
+    if (registry_is_live(&car_registry, handle)) {
+        count = stop_set_take_pending(&car->stops, &orphans);
+        __atomic_add_fetch(&stat_stranded, (uint64_t)stop_bits_count(&car->stops.bits, STOPS_CAR), __ATOMIC_RELAXED);
+        stop_set_free(&car->stops);
+        registry_release(&car_registry, handle);
+    }
+    pthread_mutex_unlock(&car->queue_mutex);
+
+    if (count > 0) {
+        redispatch_orphans(handle, have_snap ? &snap : NULL, orphans, count);
+    }
+    free(orphans);
+}
+
+// Function to answer a "STATS" request with the controller's reassignment counters and the
+// number of cars in service
+void send_stats(connection *conn) {
+    char response[160];
+    snprintf(response, sizeof(response), "STATS reassigned %llu unplaced %llu stranded %llu added_ms %llu cars %u",
+             (unsigned long long)__atomic_load_n(&stat_reassigned, __ATOMIC_RELAXED),
+             (unsigned long long)__atomic_load_n(&stat_unplaced, __ATOMIC_RELAXED),
+             (unsigned long long)__atomic_load_n(&stat_stranded, __ATOMIC_RELAXED),
+             (unsigned long long)__atomic_load_n(&stat_added_ms, __ATOMIC_RELAXED),
+             registry_count(&car_registry));
+    conn_send(conn, response, 0);
+}
+
+// Function to handle a parsed call: coalesce it with compatible calls when a window is
+// configured, otherwise dispatch it immediately.
+// Returns 1 if the reply is deferred until the group is dispatched, 0 if already answered.
+int handle_call(connection *conn, call_request *call, int tagged, unsigned int tag) {
+    if (coalesce_window_ms > 0 && coalesce_call(conn, call, tagged, tag) == 0) {
+        return 1;
+    }
+    dispatch_call(conn, call, tagged, tag);
+    return 0;
+}
+
+// Function to check whether a connection is watched for heartbeats
+static int is_watched(const connection *conn) {
+    return timer_pending(&conn->heartbeat);
+}
+
+// Function to start liveness checks on a car session that asked for heartbeats.
+// Returns 0, or -1 if its timer could not be scheduled.
+int watch_connection(event_loop *loop, connection *conn) {
+    uint64_t now = monotonic_ms();
+    __atomic_store_n(&conn->last_rx_ms, now, __ATOMIC_RELAXED);
+    conn->last_ping_ms = now;
+    return timer_schedule(&loop->timers, &conn->heartbeat, now + conn->heartbeat_ms);
+}
+
+// Function to stop liveness checks on a connection (no-op if it is not watched)
+void unwatch_connection(event_loop *loop, connection *conn) {
+    timer_cancel(&loop->timers, &conn->heartbeat);
+}
+
+// Function that applies the STATUS messages a car sends over its shared-memory link. It sleeps
+// on the ring's futex while the car is idle and exits once either side shuts the link.
+void *link_thread(void *arg) {
+    connection *conn = (connection *)arg;
+    shm_ring *ring = &conn->link->to_controller;
+    char message[SHM_MESSAGE_SIZE];
+
+    while (shm_ring_wait(conn->link, ring, -1) == 1) {
+        while (shm_ring_pop(ring, message, sizeof(message)) == 1) {
+            if (conn->heartbeat_ms > 0) {
+                __atomic_store_n(&conn->last_rx_ms, monotonic_ms(), __ATOMIC_RELAXED);
+            }
+            if (strncmp(message, "STATUS ", 7) != 0) {
+                continue;  // Ignore unknown messages from cars
+            }
+            car_info *car = registry_get(&car_registry, conn->car);
+            if (!car) {
+                return NULL;  // Taken out of service; the connection is closing
+            }
+            handle_car_status(car, message);
+        }
+    }
+    return NULL;
+}
+
+// Function to start applying a registered car's STATUS messages from its link.
+// Returns 0, or -1 if the thread could not be started.
+int start_link(connection *conn) {
+    if (pthread_create(&conn->link_tid, NULL, link_thread, conn) != 0) {
+        shm_link_shut(conn->link);
+        shm_link_close(conn->link);
+        conn->link = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Function to free a connection that nothing refers to any more
+void release_connection(connection *conn) {
+    close(conn->sockfd);
+    pthread_mutex_destroy(&conn->tx_mutex);
+    free(conn);
+}
+
+// Function to tear down a connection, removing its car from service if it had one
+void close_connection(event_loop *loop, connection *conn) {
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, conn->sockfd, NULL);
+    unwatch_connection(loop, conn);
+    if (coalesce_window_ms > 0 && (conn->kind == CONN_CALL || conn->kind == CONN_CALL_SESSION)) {
+        cancel_coalesced_calls(conn);  // Also waits out a dispatch still answering this connection
+    }
+    if (conn->link) {
+        // Stop the link thread first, and unmap the link only once the car is out of service
+        // and no dispatch can send it another FLOOR
+        shm_link_shut(conn->link);
+        pthread_join(conn->link_tid, NULL);
+    }
+    if (conn->kind == CONN_CAR) {
+        remove_car_from_service(conn->car);
+    }
+    if (conn->link) {
+        shm_link_close(conn->link);
+        conn->link = NULL;
+    }
+    if (conn->recv_armed) {
+        // The ring still has a receive outstanding on the socket. Shutting it down ends the
+        // receive, and the connection is freed when that completion arrives.
+        conn->retired = 1;
+        shutdown(conn->sockfd, SHUT_RDWR);
+        return;
+    }
+    release_connection(conn);
+}
+
+// Function to send heartbeats that are due on a loop's watched car sessions and drop the cars
+// that have been silent for HEARTBEAT_MISSES intervals (re-dispatching their calls). Only the
+// sessions whose timers have expired are visited. Returns how long the loop may sleep before
+// this is next needed (-1 if nothing is watched).
+int check_heartbeats(event_loop *loop) {
+    uint64_t now = monotonic_ms();
+    timer *expired;
+    while ((expired = timer_pop_expired(&loop->timers, now)) != NULL) {
+        connection *conn = (connection *)expired->data;
+        uint64_t interval = conn->heartbeat_ms;
+        uint64_t last_rx = __atomic_load_n(&conn->last_rx_ms, __ATOMIC_RELAXED);
+        if (now - last_rx >= HEARTBEAT_MISSES * interval) {
+            close_connection(loop, conn);  // Hung car: take it out of service
+            continue;
+        }
+        if (now - conn->last_ping_ms >= interval) {
+            conn_send(conn, HEARTBEAT_MESSAGE, 0);
+            // Keep to the interval's schedule unless a whole interval was missed
+            conn->last_ping_ms = now - conn->last_ping_ms >= 2 * interval ? now : conn->last_ping_ms + interval;
+        }
+        uint64_t due = conn->last_ping_ms + interval;
+        uint64_t dead_at = last_rx + HEARTBEAT_MISSES * interval;
+        timer_schedule(&loop->timers, &conn->heartbeat, dead_at < due ? dead_at : due);  // Cannot fail: it was just popped
+    }
+    return timer_timeout_ms(&loop->timers, now);
+}
+
+// Function to run one complete message through the connection's session state machine.
+// Returns 0 to keep the connection open or -1 to close it.
+int process_message(connection *conn, const char *message, size_t len) {
+    switch (conn->kind) {
+    case CONN_NEW:
+        // The first message decides what kind of session this is
+        if (strncmp(message, "CAR ", 4) == 0) {
+            conn->car = register_car(conn, message);
+            if (conn->car == REGISTRY_NO_HANDLE) {
+                return -1;
+            }
+            conn->kind = CONN_CAR;
+            if (conn->link && start_link(conn) != 0) {
+                return -1;
+            }
+            return 0;
+        }
+        if (strcmp(message, "STATS") == 0) {
+            send_stats(conn);  // One-shot query
+            conn_finish(conn);
+            return 0;
+        }
+        if (strncmp(message, "CALL ", 5) == 0) {
+            call_request call;
+            int tagged;
+            unsigned int tag;
+            if (parse_call(message, &call, &tagged, &tag) != 0) {
+                reply_to_call(conn, tagged, tag, NULL);
+                if (tagged) {
+                    conn->kind = CONN_CALL_SESSION;  // Later calls in the session still count
+                } else {
+                    conn_finish(conn);
+                }
+                return 0;
+            }
+            if (tagged) {
+                // A tagged call opens a persistent session for further pipelined calls
+                conn->kind = CONN_CALL_SESSION;
+                handle_call(conn, &call, tagged, tag);
+                return 0;
+            }
+            // One-shot call: dispatch it and close the connection once answered
+            conn->kind = CONN_CALL;
+            if (!handle_call(conn, &call, tagged, tag)) {
+                conn_finish(conn);
+            }
+            return 0;
+        }
+        return -1;
+
+    case CONN_CALL_SESSION:
+        if (strncmp(message, "CALL ", 5) == 0) {
+            call_request call;
+            int tagged;
+            unsigned int tag;
+            if (parse_call(message, &call, &tagged, &tag) != 0 || !tagged) {
+                // Untagged or malformed requests cannot be matched to a reply, so answer
+                // with the tag if one could be read and otherwise end the session
+                if (tagged) {
+                    reply_to_call(conn, tagged, tag, NULL);
+                    return 0;
+                }
+                return -1;
+            }
+            handle_call(conn, &call, tagged, tag);
+            return 0;
+        }
+        return -1;
+
+    case CONN_CAR:
+        if (conn->link && (strncmp(message, "STATUS ", 7) == 0 || (len > 0 && (unsigned char)message[0] == BIN_STATUS_FRAME))) {
+            // Sent before the car switched to the link, which repeats its status on switching;
+            // applying it now could overwrite a newer status from the link
+            return 0;
+        }
+        if (len > 0 && (unsigned char)message[0] == BIN_STATUS_FRAME) {
+            car_info *car = registry_get(&car_registry, conn->car);
+            if (!car || !car->binary) {
+                return -1;  // Out of service, or binary frames without having negotiated them
+            }
+            handle_car_bin_status(car, message, len);
+            return 0;
+        }
+        if (strncmp(message, "STATUS ", 7) == 0) {
+            car_info *car = registry_get(&car_registry, conn->car);
+            if (!car) {
+                return -1;  // The car was taken out of service elsewhere
+            }
+            handle_car_status(car, message);
+            return 0;
+        }
+        if (strcmp(message, "INDIVIDUAL SERVICE") == 0 || strcmp(message, "EMERGENCY") == 0) {
+            // The car is leaving automatic operation, so drop the session
+            return -1;
+        }
+        return 0;  // Ignore unknown messages from cars
+
+    case CONN_CALL:
+        return 0;  // Answered or about to be; the connection closes once the reply is out
+
+    default:
+        return -1;
+    }
+}
+
+// Function to run every complete frame in a connection's reader through its session.
+// Returns 0 to keep the connection open or -1 to close it.
+int process_frames(connection *conn) {
+    char *message;
+    size_t len;
+    int status;
+    while ((status = frame_reader_next(&conn->rx, &message, &len)) == 1) {
+        if (process_message(conn, message, len) != 0) {
+            return -1;
+        }
+    }
+    return status < 0 ? -1 : 0;  // An oversized frame means the peer is broken
+}
+
+// Function to read whatever is available on a connection and process every complete message.
+// Returns 0 to keep the connection open or -1 to close it.
+int service_connection(connection *conn) {
+    ssize_t n = frame_reader_fill(&conn->rx, conn->sockfd);
+    if (n == 0) {
+        return -1;  // Peer closed the connection
+    }
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    if (is_watched(conn)) {
+        __atomic_store_n(&conn->last_rx_ms, monotonic_ms(), __ATOMIC_RELAXED);  // Any traffic shows the car is alive
+    }
+
+    // Process every complete length-prefixed frame in the buffer, in place, corking the
+    // connection so all the replies go out together
+    conn_cork(conn);
+    int status = process_frames(conn);
+    conn_uncork(conn);
+    return status;
+}
+
+
+// Function to set up a connection for an accepted socket and add it to a loop's epoll set
+// (for reading and writing, or only for writing under io_uring). Returns NULL on failure,
+// having closed the socket.
+connection *open_connection(event_loop *loop, int sockfd) {
+    connection *conn = calloc(1, sizeof(connection));
+    if (!conn) {
+        close(sockfd);
+        return NULL;
+    }
+    set_nodelay(sockfd);  // FLOOR and CAR replies must not wait on Nagle's algorithm (TCP only)
+    conn->sockfd = sockfd;
+    conn->epoll_fd = loop->epoll_fd;
+    conn->kind = CONN_NEW;
+    pthread_mutex_init(&conn->tx_mutex, NULL);
+    tx_queue_init(&conn->tx);
+    frame_reader_init(&conn->rx);
+    timer_init(&conn->heartbeat, conn);
+
+    struct epoll_event ev;
+    ev.events = use_io_uring ? 0 : EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = conn;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, sockfd, &ev) != 0) {
+        perror("epoll_ctl");
+        release_connection(conn);
+        return NULL;
+    }
+    return conn;
+}
+
+// Function to accept all pending connections and register them with an event loop
+void accept_connections(event_loop *loop, int listen_fd) {
+    for (int i = 0; i < ACCEPT_BATCH; ++i) {
+        int sockfd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (sockfd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+                perror("accept");
+            }
+            return;
+        }
+
+        open_connection(loop, sockfd);
+    }
+}
+
+// Function to get how long an event loop may sleep: until the next coalescing window closes or
+// heartbeat check is due (-1, forever, if nothing is pending)
+int loop_timeout_ms(event_loop *loop) {
+    int timeout = coalesce_window_ms > 0 ? coalesce_timeout_ms() : -1;
+    int heartbeat_timeout = check_heartbeats(loop);
+    if (heartbeat_timeout >= 0 && (timeout < 0 || heartbeat_timeout < timeout)) {
+        timeout = heartbeat_timeout;
+    }
+    return timeout;
+}
+
+// Event loop thread: waits for activity on its connections and runs their state machines
+void *event_loop_thread(void *arg) {
+    event_loop *loop = (event_loop *)arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (keep_running) {
+        int n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, loop_timeout_ms(loop));
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;  // Interrupted by a signal, re-check keep_running
+            }
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            void *ptr = events[i].data.ptr;
+            if (ptr >= (void *)listen_socks && ptr < (void *)(listen_socks + listener_count)) {
+                accept_connections(loop, *(int *)ptr);
+            } else if (ptr == &wake_fd) {
+                // Shutdown requested; leave the eventfd signalled so every loop sees it
+                keep_running = 0;
+            } else {
+                connection *conn = (connection *)ptr;
+                if (events[i].events & EPOLLOUT) {
+                    conn_flush(conn);  // Drain replies or FLOOR updates the socket could not take
+                }
+                if ((events[i].events & ~EPOLLOUT) && service_connection(conn) != 0) {
+                    close_connection(loop, conn);
+                } else if (conn->heartbeat_ms > 0 && !is_watched(conn)) {
+                    // Car session that just asked for heartbeats
+                    if (watch_connection(loop, conn) != 0) {
+                        close_connection(loop, conn);
+                    }
+                }
+            }
+        }
+
+        if (coalesce_window_ms > 0) {
+            flush_coalesced_calls();
+        }
+    }
+
+    // Wake the remaining loops so they notice the shutdown too
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        // Nothing more can be done during shutdown
+    }
+    return NULL;
+}
+
+// Function to queue a multishot accept on a listening socket (io_uring backend)
+static void uring_arm_accept(event_loop *loop, int *listen_fd) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = *listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;  // Replies are still written directly, without blocking
+    sqe->user_data = (uint64_t)(uintptr_t)listen_fd;
+}
+
+// Function to queue a multishot receive on a connection, taking buffers from the loop's group
+static void uring_arm_recv(event_loop *loop, connection *conn) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    if (!sqe) {
+        shutdown(conn->sockfd, SHUT_RDWR);  // Cannot read from it, so end the session
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->sockfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = (uint64_t)(uintptr_t)conn;
+    conn->recv_armed = 1;
+}
+
+// Function to queue a poll for readability; `ptr` identifies the completion
+static void uring_arm_poll(event_loop *loop, int fd, void *ptr, int multishot) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = (uint64_t)(uintptr_t)ptr;
+}
+
+// Function to run the bytes of one receive completion through a connection's session.
+// Returns 0 to keep the connection open or -1 to close it.
+int uring_service_connection(connection *conn, const char *data, size_t len) {
+    if (is_watched(conn)) {
+        __atomic_store_n(&conn->last_rx_ms, monotonic_ms(), __ATOMIC_RELAXED);  // Any traffic shows the car is alive
+    }
+
+    // Feed the reader as much as fits, taking complete frames out to make room for the rest;
+    // replies to everything in this buffer go out together
+    int status = 0;
+    conn_cork(conn);
+    while (len > 0 && status == 0) {
+        size_t taken = frame_reader_feed(&conn->rx, data, len);
+        data += taken;
+        len -= taken;
+        status = process_frames(conn);
+        if (taken == 0 && status == 0) {
+            status = -1;  // No room and no complete frame: cannot make progress
+        }
+    }
+    conn_uncork(conn);
+    return status;
+}
+
+// Function to handle a receive completion: consume its buffer, then close or re-arm as needed
+static void uring_handle_recv(event_loop *loop, connection *conn, int res, unsigned flags) {
+    if (!(flags & IORING_CQE_F_MORE)) {
+        conn->recv_armed = 0;  // The multishot receive has ended
+    }
+
+    int status = 0;
+    if (flags & IORING_CQE_F_BUFFER) {
+        unsigned id = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (res > 0 && !conn->retired) {
+            status = uring_service_connection(conn, uring_buffer(&loop->buffers, id), (size_t)res);
+        }
+        uring_buffer_recycle(&loop->buffers, id);
+    }
+
+    if (conn->retired) {
+        if (!conn->recv_armed) {
+            release_connection(conn);  // The last reference from the ring is gone
+        }
+        return;
+    }
+    if (status != 0 || res == 0 || (res < 0 && res != -ENOBUFS)) {
+        close_connection(loop, conn);  // Broken peer, peer closed, or socket error
+    } else if (!conn->recv_armed) {
+        uring_arm_recv(loop, conn);  // Ran out of buffers, or the kernel ended the multishot
+    } else if (conn->heartbeat_ms > 0 && !is_watched(conn)) {
+        // Car session that just asked for heartbeats
+        if (watch_connection(loop, conn) != 0) {
+            close_connection(loop, conn);
+        }
+    }
+}
+
+// Event loop thread for the io_uring backend. Connections are accepted and read through
+// multishot requests whose completions are reaped in batches; all re-armed requests go to the
+// kernel in the same io_uring_enter() that waits for the next batch. Replies are still written
+// directly by conn_send() (any loop may send a FLOOR to any car), with the loop's epoll set,
+// polled through the ring, watching sockets that could not take a whole reply.
+void *uring_loop_thread(void *arg) {
+    event_loop *loop = (event_loop *)arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    for (int l = 0; l < listener_count; ++l) {
+        uring_arm_accept(loop, &listen_socks[l]);
+    }
+    uring_arm_poll(loop, wake_fd, &wake_fd, 0);
+    uring_arm_poll(loop, loop->epoll_fd, &loop->epoll_fd, 1);
+
+    while (keep_running) {
+        int result = uring_submit_and_wait(&loop->ring, loop_timeout_ms(loop));
+        if (result < 0) {
+            fprintf(stderr, "io_uring_enter: %s\n", strerror(-result));
+            break;
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&loop->ring)) != NULL) {
+            void *ptr = (void *)(uintptr_t)cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            uring_cqe_seen(&loop->ring);
+
+            if (ptr >= (void *)listen_socks && ptr < (void *)(listen_socks + listener_count)) {
+                if (res >= 0) {
+                    connection *conn = open_connection(loop, res);
+                    if (conn) {
+                        uring_arm_recv(loop, conn);
+                    }
+                }
+                if (!(flags & IORING_CQE_F_MORE)) {
+                    uring_arm_accept(loop, (int *)ptr);
+                }
+            } else if (ptr == &wake_fd) {
+                // Shutdown requested; leave the eventfd signalled so every loop sees it
+                keep_running = 0;
+            } else if (ptr == &loop->epoll_fd) {
+                // Sockets that were full can take more of their queued replies
+                int n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, 0);
+                for (int i = 0; i < n; ++i) {
+                    conn_flush((connection *)events[i].data.ptr);
+                }
+                if (!(flags & IORING_CQE_F_MORE)) {
+                    uring_arm_poll(loop, loop->epoll_fd, &loop->epoll_fd, 1);
+                }
+            } else if (ptr) {
+                uring_handle_recv(loop, (connection *)ptr, res, flags);
+            }
+        }
+
+        if (coalesce_window_ms > 0) {
+            flush_coalesced_calls();
+        }
+    }
+
+    // Wake the remaining loops so they notice the shutdown too
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        // Nothing more can be done during shutdown
+    }
+    return NULL;
+}
+
+// Function to give every event loop an io_uring ring and receive buffers. Returns 0, or -1
+// (with nothing left set up) if the kernel does not support what the backend needs.
+int setup_uring_loops(void) {
+    for (int i = 0; i < EVENT_THREADS; ++i) {
+        if (uring_init(&loops[i].ring, URING_ENTRIES) != 0) {
+            perror("io_uring_setup");
+            loops[i].ring.fd = -1;
+        } else if (uring_buffers_init(&loops[i].ring, &loops[i].buffers, URING_BUFFER_GROUP,
+                                      URING_BUFFERS, URING_BUFFER_SIZE) != 0) {
+            perror("io_uring provided buffers");
+            uring_free(&loops[i].ring);
+        }
+        if (loops[i].ring.fd < 0) {
+            for (int j = 0; j < i; ++j) {
+                uring_buffers_free(&loops[j].ring, &loops[j].buffers);
+                uring_free(&loops[j].ring);
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Function to create a non-blocking listening socket bound to an address.
+// Returns the socket, or -1 (after reporting the error) on failure.
+int open_listener(int domain, const struct sockaddr *addr, socklen_t addr_len) {
+    int opt_enable = 1;
+    int sockfd = socket(domain, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sockfd == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    // Set socket options to allow address reuse
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt_enable, sizeof(opt_enable));
+
+    // Bind the socket to the address and start listening for incoming connections
+    if (bind(sockfd, addr, addr_len) != 0) {
+        perror("bind");
+        close(sockfd);
+        return -1;
+    }
+    if (listen(sockfd, listen_backlog) != 0) {
+        perror("listen");
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+// Main controller loop that listens for incoming connections (either cars or calls)
+void run_controller() {
+    registry_init(&car_registry, sizeof(car_info), construct_car);
+
+    // Listen on TCP unless disabled
+    if (listen_tcp) {
+        struct sockaddr_in serv_addr;
+        memset(&serv_addr, 0, sizeof(serv_addr));
+        serv_addr.sin_family = AF_INET;
+        serv_addr.sin_addr.s_addr = inet_addr(CONTROLLER_IP);
+        serv_addr.sin_port = htons(CONTROLLER_PORT);
+        int sockfd = open_listener(AF_INET, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
+        if (sockfd == -1) {
+            exit(EXIT_FAILURE);
+        }
+        listen_socks[listener_count++] = sockfd;
+    }
+
+    // And on a Unix domain socket for co-located cars and callers, if one was given
+    if (unix_path) {
+        struct sockaddr_un unix_addr;
+        socklen_t unix_len;
+        if (unix_address(unix_path, &unix_addr, &unix_len) != 0) {
+            fprintf(stderr, "Invalid Unix socket path: %s\n", unix_path);
+            exit(EXIT_FAILURE);
+        }
+        if (unix_path[0] != '@') {
+            unlink(unix_path);  // Remove a socket file left behind by an earlier run
+        }
+        int sockfd = open_listener(AF_UNIX, (struct sockaddr *)&unix_addr, unix_len);
+        if (sockfd == -1) {
+            exit(EXIT_FAILURE);
+        }
+        listen_socks[listener_count++] = sockfd;
+    }
+
+    // Semaphore-style eventfd used to wake all loops at shutdown
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (wake_fd == -1) {
+        perror("eventfd");
+        exit(EXIT_FAILURE);
+    }
+
+    // The io_uring backend falls back to epoll on kernels without the features it needs
+    if (use_io_uring && setup_uring_loops() != 0) {
+        fprintf(stderr, "io_uring unavailable, using epoll\n");
+        use_io_uring = 0;
+    }
+
+    // Create the event loops; each watches the shared listen socket and its own connections
+    // (under io_uring the ring does that, and the epoll set only tracks writability)
+    for (int i = 0; i < EVENT_THREADS; ++i) {
+        timer_heap_init(&loops[i].timers);
+        loops[i].epoll_fd = epoll_create1(0);
+        if (loops[i].epoll_fd == -1) {
+            perror("epoll_create1");
+            exit(EXIT_FAILURE);
+        }
+        if (use_io_uring) {
+            continue;
+        }
+
+        struct epoll_event ev;
+        for (int l = 0; l < listener_count; ++l) {
+            ev.events = EPOLLIN | EPOLLEXCLUSIVE;  // Only wake one loop per incoming connection
+            ev.data.ptr = &listen_socks[l];
+            epoll_ctl(loops[i].epoll_fd, EPOLL_CTL_ADD, listen_socks[l], &ev);
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = &wake_fd;
+        epoll_ctl(loops[i].epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+    }
+
+    // Only the main thread should receive SIGINT, so block it while spawning the loops
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    void *(*loop_thread)(void *) = use_io_uring ? uring_loop_thread : event_loop_thread;
+    for (int i = 1; i < EVENT_THREADS; ++i) {
+        pthread_create(&loops[i].tid, NULL, loop_thread, &loops[i]);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    // The main thread runs the first loop itself
+    loop_thread(&loops[0]);
+
+    for (int i = 1; i < EVENT_THREADS; ++i) {
+        pthread_join(loops[i].tid, NULL);
+    }
+    for (int i = 0; i < EVENT_THREADS; ++i) {
+        close(loops[i].epoll_fd);
+        timer_heap_free(&loops[i].timers);
+        if (use_io_uring) {
+            uring_buffers_free(&loops[i].ring, &loops[i].buffers);
+            uring_free(&loops[i].ring);
+        }
+    }
+    close(wake_fd);
+    for (int l = 0; l < listener_count; ++l) {
+        close(listen_socks[l]);  // Close the listening sockets when done
+    }
+    if (unix_path && unix_path[0] != '@') {
+        unlink(unix_path);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    // Options: --coalesce-ms {ms} holds hall calls that long to merge compatible ones, and
+    // --destination-dispatch groups passengers into cars by destination
+    unix_path = getenv(CONTROLLER_SOCKET_ENV);
+    if (unix_path && !*unix_path) {
+        unix_path = NULL;
+    }
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--coalesce-ms") == 0 && i + 1 < argc) {
+            coalesce_window_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--destination-dispatch") == 0) {
+            destination_dispatch = 1;
+        } else if (strcmp(argv[i], "--batch-ms") == 0 && i + 1 < argc) {
+            batch_horizon_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--reassign") == 0) {
+            reassign_calls = 1;
+        } else if (strcmp(argv[i], "--unix") == 0 && i + 1 < argc) {
+            unix_path = argv[++i];
+        } else if (strcmp(argv[i], "--no-tcp") == 0) {
+            listen_tcp = 0;
+        } else if (strcmp(argv[i], "--backlog") == 0 && i + 1 < argc) {
+            listen_backlog = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--io-uring") == 0) {
+            use_io_uring = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [--coalesce-ms {ms}] [--destination-dispatch] [--batch-ms {ms} [--reassign]]"
+                            " [--unix {path}] [--no-tcp] [--backlog {n}] [--io-uring]\n"
+                            "  --batch-ms matches up to %d calls per batch against at most %d cars: each call's\n"
+                            "  best car, then the cars best placed for any of the calls\n",
+                    argv[0], BATCH_MAX_ROWS, BATCH_MAX_CARS);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // --batch-ms {ms} collects calls for that long and assigns them together (the horizon
+    // replaces the coalescing window); --reassign lets open session calls move between cars
+    if (batch_horizon_ms > 0) {
+        coalesce_window_ms = batch_horizon_ms;
+    } else {
+        reassign_calls = 0;
+    }
+    if (coalesce_window_ms < 0) {
+        coalesce_window_ms = 0;
+    }
+
+    // --unix {path} also listens on a Unix domain socket for co-located processes ('@name' for
+    // the abstract namespace; defaults to $ELEVATOR_SOCKET), and --no-tcp turns TCP off.
+    // --backlog {n} sizes the accept queues so a whole fleet reconnecting at once is not refused.
+    // --io-uring runs the event loops on io_uring (falling back to epoll where unsupported).
+    if (listen_backlog <= 0) {
+        listen_backlog = DEFAULT_LISTEN_BACKLOG;
+    }
+    if (!listen_tcp && !unix_path) {
+        fprintf(stderr, "--no-tcp needs a Unix socket (--unix or $%s)\n", CONTROLLER_SOCKET_ENV);
+        exit(EXIT_FAILURE);
+    }
+
     setup_signal_handler(int_handler);  // Set up signal handler for SIGINT
     signal(SIGPIPE, SIG_IGN);  // Ignore SIGPIPE to avoid crashes on broken pipes
     run_controller();  // Start the main controller loop
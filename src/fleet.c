@@ -0,0 +1,612 @@
+#include "fleet.h"              // Include the fleet mode entry point and limits
+#include "car_engine.h"         // Include the door and travel state machine
+#include "shared_memory.h"      // Include functions for managing shared memory
+#include "network.h"            // Include functions for network communication
+#include "timer.h"              // Include the deadline timers shared by a worker's cars
+#include "utils.h"              // Include utility functions, such as time-related functions
+#include <stdio.h>              // Standard I/O library
+#include <stdlib.h>             // Standard library for memory allocation and conversion
+#include <string.h>             // String manipulation functions
+#include <pthread.h>            // POSIX threads for the worker pool
+#include <unistd.h>             // UNIX standard functions (e.g., close())
+#include <signal.h>             // Signal handling for interrupts
+#include <errno.h>              // Error number definitions
+#include <sys/epoll.h>          // epoll to wait for many car sessions at once
+#include <sys/eventfd.h>        // eventfd used to wake the workers on shutdown
+
+#define FLEET_MAX_EVENTS 64     // Socket events handled per epoll_wait()
+#define RECONNECT_MAX_BACKOFF_MS 2000  // As for a single car
+
+// Where a car's session with the controller is
+typedef enum {
+    SESSION_IDLE,               // Not connected (a connection attempt may be scheduled)
+    SESSION_CONNECTING,         // Non-blocking connect() in progress
+    SESSION_OPEN                // CAR sent; STATUS and FLOOR (or ITINERARY) flowing
+} session_state;
+
+struct fleet_worker;
+
+// One car hosted by the fleet. Everything but the shared memory is only touched by its worker.
+typedef struct {
+    char name[FLEET_NAME_SIZE];             // Car name
+    char shm_name[FLEET_NAME_SIZE + 4];     // "/car" followed by the name
+    char lowest_floor[FLOOR_STR_SIZE];      // Range of the car
+    char highest_floor[FLOOR_STR_SIZE];
+    int delay;                              // Length of every phase in milliseconds
+    car_shared_mem *car_mem;                // Shared memory for car state (NULL until created)
+    car_engine engine;                      // Door and travel state machine
+    struct fleet_worker *worker;            // Worker driving this car
+
+    session_state state;                    // Session with the controller
+    int sockfd;                             // Socket of the session (-1 when idle)
+    frame_reader rx;                        // Bytes received but not yet handled
+    tx_queue tx;                            // Frames not yet written to the socket
+    int want_out;                           // Whether EPOLLOUT is armed to drain tx
+    int binary_active;                      // The controller accepted the binary protocol
+    int announced;                          // The controller was told the car left normal service
+    reported_state reported;                // What the controller was last told
+    uint16_t tx_seq;                        // Sequence number of the last binary STATUS sent
+    uint64_t last_rx_ms;                    // When anything was last received (heartbeats)
+    int backoff_ms;                         // Current reconnection backoff window
+    timer session;                          // Next connection attempt, connect timeout or heartbeat
+} fleet_car;
+
+// One worker thread and the cars it drives
+typedef struct fleet_worker {
+    pthread_t tid;                          // Thread running the worker
+    int epoll_fd;                           // epoll instance watching the cars' sockets
+    timer_heap timers;                      // Phase and session timers of the cars, and poll
+    timer poll;                             // Next check of every car's shared memory
+    fleet_car **cars;                       // Cars driven by this worker
+    int car_count;
+    unsigned int seed;                      // Jitter source for reconnections
+} fleet_worker;
+
+static const car_options *fleet_options;    // Options shared by every car
+static volatile sig_atomic_t fleet_running = 1;
+static int fleet_wake_fd = -1;              // eventfd signalled to stop all workers
+
+// Function to parse one "{name}:{lowest}:{highest}:{delay}[:{count}]" entry of a spec.
+// Returns 0, or -1 if it is malformed.
+static int parse_entry(char *entry, char **name, char **lowest, char **highest, int *delay, int *count) {
+    char *fields[5];
+    int n = 0;
+    char *save;
+    for (char *field = strtok_r(entry, ":", &save); field; field = strtok_r(NULL, ":", &save)) {
+        if (n == 5) {
+            return -1;
+        }
+        fields[n++] = field;
+    }
+    if (n < 4) {
+        return -1;
+    }
+    *name = fields[0];
+    *lowest = fields[1];
+    *highest = fields[2];
+    *delay = atoi(fields[3]);
+    *count = n == 5 ? atoi(fields[4]) : 0;
+    if (!is_valid_floor(*lowest) || !is_valid_floor(*highest) ||
+        compare_floors(*lowest, *highest) > 0 || *delay <= 0 || (n == 5 && *count <= 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Function to expand a spec into cars. Returns the number of cars, or -1 (after reporting the
+// problem) if the spec is invalid. The array is allocated for the caller, who must free it.
+static int parse_spec(const char *spec, fleet_car **out) {
+    char *copy = strdup(spec);
+    fleet_car *cars = NULL;
+    int total = 0;
+    char *save;
+
+    if (!copy) {
+        return -1;
+    }
+    for (char *entry = strtok_r(copy, ",", &save); entry; entry = strtok_r(NULL, ",", &save)) {
+        char *name, *lowest, *highest;
+        int delay, count;
+        if (parse_entry(entry, &name, &lowest, &highest, &delay, &count) != 0) {
+            fprintf(stderr, "Invalid fleet entry: %s\n", entry);
+            goto fail;
+        }
+        int cars_in_entry = count ? count : 1;
+        if (cars_in_entry > FLEET_MAX_CARS - total) {
+            fprintf(stderr, "A fleet may have at most %d cars.\n", FLEET_MAX_CARS);
+            goto fail;
+        }
+        fleet_car *grown = realloc(cars, (total + cars_in_entry) * sizeof(fleet_car));
+        if (!grown) {
+            perror("realloc");
+            goto fail;
+        }
+        cars = grown;
+        for (int i = 0; i < cars_in_entry; ++i) {
+            fleet_car *car = &cars[total + i];
+            memset(car, 0, sizeof(*car));
+            int len = count ? snprintf(car->name, sizeof(car->name), "%s%d", name, i + 1)
+                            : snprintf(car->name, sizeof(car->name), "%s", name);
+            if (len <= 0 || len >= (int)sizeof(car->name) || strpbrk(car->name, " \t\n") != NULL) {
+                fprintf(stderr, "Invalid car name in fleet entry: %s\n", name);
+                goto fail;
+            }
+            snprintf(car->shm_name, sizeof(car->shm_name), "/car%s", car->name);
+            snprintf(car->lowest_floor, sizeof(car->lowest_floor), "%s", lowest);
+            snprintf(car->highest_floor, sizeof(car->highest_floor), "%s", highest);
+            car->delay = delay;
+            car->sockfd = -1;
+        }
+        total += cars_in_entry;
+    }
+    free(copy);
+    if (total == 0) {
+        fprintf(stderr, "The fleet has no cars.\n");
+        free(cars);
+        return -1;
+    }
+    *out = cars;
+    return total;
+
+fail:
+    free(copy);
+    free(cars);
+    return -1;
+}
+
+// Function to change which events a car's socket is watched for
+static void watch_socket(fleet_car *car, uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = car;
+    epoll_ctl(car->worker->epoll_fd, EPOLL_CTL_MOD, car->sockfd, &ev);
+}
+
+// Function to schedule a car's session timer
+static void schedule_session(fleet_car *car, uint64_t deadline_ms) {
+    if (timer_schedule(&car->worker->timers, &car->session, deadline_ms) != 0) {
+        perror("timer_schedule");
+        exit(EXIT_FAILURE);  // Only possible while the heap is growing, at start-up
+    }
+}
+
+// Function to pick how long to wait before the next connection attempt (see next_backoff() in
+// car.c: the window doubles after every failure, and the wait comes from its upper half)
+static int next_backoff(fleet_car *car) {
+    int window = car->backoff_ms;
+    int wait = window / 2 + rand_r(&car->worker->seed) % (window / 2 + 1);
+    int limit = car->delay > RECONNECT_MAX_BACKOFF_MS ? car->delay : RECONNECT_MAX_BACKOFF_MS;
+    car->backoff_ms = window > limit / 2 ? limit : window * 2;
+    return wait;
+}
+
+// Function to end a car's session. Unless the car is out of normal service, the next connection
+// attempt is made after retry_ms.
+static void end_session(fleet_car *car, int retry_ms) {
+    if (car->sockfd != -1) {
+        close(car->sockfd);  // Also takes it out of the epoll set
+        car->sockfd = -1;
+    }
+    car->state = SESSION_IDLE;
+    car->want_out = 0;
+    if (fleet_options->itinerary) {
+        // The car finishes its current trip; the next session brings a fresh itinerary
+        pthread_mutex_lock(&car->car_mem->mutex);
+        car_engine_set_itinerary(&car->engine, NULL, 0);
+        pthread_mutex_unlock(&car->car_mem->mutex);
+    }
+    schedule_session(car, monotonic_ms() + retry_ms);
+}
+
+// Function to write as much of a car's outbound queue as the socket takes, watching for
+// writability while data remains. Ends the session on a socket error.
+static void flush_car(fleet_car *car) {
+    if (car->state != SESSION_OPEN) {
+        return;
+    }
+    int result = tx_queue_flush(&car->tx, car->sockfd);
+    if (result < 0) {
+        end_session(car, rand_r(&car->worker->seed) % (car->delay + 1));
+    } else if ((result == 1) != car->want_out) {
+        car->want_out = result == 1;
+        watch_socket(car, EPOLLIN | EPOLLRDHUP | (car->want_out ? EPOLLOUT : 0));
+    }
+}
+
+// Function to queue the car's status, as a binary frame once the controller has accepted that
+// protocol. A STATUS still queued is replaced, as only the latest one matters. Returns 0, or -1
+// if the controller is not keeping up. Called with car_mem->mutex held.
+static int queue_status(fleet_car *car) {
+    car_shared_mem *car_mem = car->car_mem;
+    record_state(car_mem, &car->reported);
+    if (car->binary_active) {
+        unsigned char frame[BIN_STATUS_SIZE];
+        encode_bin_status(frame, status_code(car_mem->status), ++car->tx_seq,
+                          floor_to_int(car_mem->current_floor), floor_to_int(car_mem->destination_floor));
+        return tx_queue_push_frame(&car->tx, frame, sizeof(frame), 1);
+    }
+    char message[128];
+    format_status(car_mem, message, sizeof(message));
+    return tx_queue_push(&car->tx, message, 1);
+}
+
+// Function to arm the session timer of an open session: the next idle STATUS and the point at
+// which a silent controller is presumed dead (heartbeat sessions only)
+static void arm_heartbeat(fleet_car *car) {
+    int heartbeat_ms = fleet_options->heartbeat_ms;
+    if (heartbeat_ms <= 0) {
+        timer_cancel(&car->worker->timers, &car->session);
+        return;
+    }
+    uint64_t deadline = car->last_rx_ms + HEARTBEAT_MISSES * heartbeat_ms;
+    if (!car->announced && car->reported.sent_ms + heartbeat_ms < deadline) {
+        deadline = car->reported.sent_ms + heartbeat_ms;
+    }
+    schedule_session(car, deadline);
+}
+
+// Function to bring a car up to date: apply whatever changed in its shared memory, finish its
+// running phase if that timer expired, and tell the controller about the result. Mirrors
+// controller_thread() in car.c for the session.
+static void update_car(fleet_car *car, int phase_expired) {
+    car_shared_mem *car_mem = car->car_mem;
+    uint64_t now = monotonic_ms();
+    int lost = 0;
+
+    pthread_mutex_lock(&car_mem->mutex);
+    int changed = car_engine_step(&car->engine, now);
+    if (phase_expired && !changed) {
+        car_engine_expire(&car->engine);  // A button may have started another phase instead
+        changed = 1;
+    }
+    if (changed) {
+        pthread_cond_broadcast(&car_mem->cond);  // Notify other processes watching the car
+    }
+
+    int in_special_mode = car_mem->individual_service_mode || car_mem->emergency_mode;
+    if (car->state == SESSION_OPEN) {
+        if (in_special_mode && !car->announced) {
+            // Tell the controller once, so it stops dispatching to the car
+            car->announced = 1;
+            lost = tx_queue_push(&car->tx, car_mem->emergency_mode ? "EMERGENCY" : "INDIVIDUAL SERVICE", 0) != 0;
+        } else if (!in_special_mode && car->announced) {
+            lost = 1;  // Back in normal service: start over with a CAR message
+        } else if (!in_special_mode &&
+                   (state_changed(car_mem, &car->reported) ||
+                    (fleet_options->heartbeat_ms > 0 && now - car->reported.sent_ms >= (uint64_t)fleet_options->heartbeat_ms))) {
+            lost = queue_status(car) != 0;
+        }
+    } else if (car->state == SESSION_IDLE && !in_special_mode && !timer_pending(&car->session)) {
+        schedule_session(car, now);  // Left special mode: connect again
+    }
+    pthread_mutex_unlock(&car_mem->mutex);
+
+    if (car->state != SESSION_OPEN) {
+        return;
+    }
+    if (lost) {
+        end_session(car, car->announced ? 0 : rand_r(&car->worker->seed) % (car->delay + 1));
+        return;
+    }
+    arm_heartbeat(car);
+    flush_car(car);
+}
+
+// Function to start a session once the socket is connected: introduce the car with its CAR
+// and first STATUS messages, sent together
+static void open_session(fleet_car *car) {
+    char message[256];
+    int length = snprintf(message, sizeof(message), "CAR %s %s %s%s%s", car->name, car->lowest_floor, car->highest_floor,
+                          fleet_options->binary ? " " BINARY_PROTOCOL : "", fleet_options->itinerary ? " " ITINERARY_TOKEN : "");
+    if (fleet_options->motion.cruise_ms > 0) {
+        length += snprintf(message + length, sizeof(message) - length, " " MOTION_TOKEN " %d %d",
+                           fleet_options->motion.cruise_ms, fleet_options->motion.accel_ms);
+    }
+    if (fleet_options->heartbeat_ms > 0) {
+        snprintf(message + length, sizeof(message) - length, " " HEARTBEAT_TOKEN " %d", fleet_options->heartbeat_ms);
+    }
+
+    car->state = SESSION_OPEN;
+    car->backoff_ms = car->delay;  // Connected: the next outage starts from a short window
+    car->binary_active = 0;        // Text until the controller accepts the offer
+    car->announced = 0;
+    car->want_out = 0;
+    car->last_rx_ms = monotonic_ms();
+    frame_reader_init(&car->rx);
+    tx_queue_init(&car->tx);
+    tx_queue_push(&car->tx, message, 0);
+    pthread_mutex_lock(&car->car_mem->mutex);
+    queue_status(car);
+    pthread_mutex_unlock(&car->car_mem->mutex);
+
+    watch_socket(car, EPOLLIN | EPOLLRDHUP);
+    arm_heartbeat(car);
+    flush_car(car);
+}
+
+// Function to start connecting a car to the controller, unless it is out of normal service
+static void start_session(fleet_car *car) {
+    pthread_mutex_lock(&car->car_mem->mutex);
+    int in_special_mode = car->car_mem->individual_service_mode || car->car_mem->emergency_mode;
+    pthread_mutex_unlock(&car->car_mem->mutex);
+    if (in_special_mode) {
+        return;  // update_car() schedules the attempt once the car is back in normal service
+    }
+
+    int in_progress;
+    int sockfd = connect_to_controller_nonblocking(&in_progress);
+    if (sockfd == -1) {
+        schedule_session(car, monotonic_ms() + next_backoff(car));
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = in_progress ? EPOLLOUT : EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = car;
+    if (epoll_ctl(car->worker->epoll_fd, EPOLL_CTL_ADD, sockfd, &ev) != 0) {
+        perror("epoll_ctl");
+        close(sockfd);
+        schedule_session(car, monotonic_ms() + next_backoff(car));
+        return;
+    }
+    car->sockfd = sockfd;
+    if (in_progress) {
+        car->state = SESSION_CONNECTING;
+        schedule_session(car, monotonic_ms() + CONNECT_TIMEOUT_MS);
+    } else {
+        open_session(car);
+    }
+}
+
+// Function to act on one message from the controller. Called with car_mem->mutex held.
+static void handle_message(fleet_car *car, const char *message, size_t len) {
+    int floor;
+    uint16_t seq;
+    if (decode_bin_floor(message, len, &seq, &floor) == 0) {
+        char floor_str[FLOOR_STR_SIZE];
+        int_to_floor(floor, floor_str);
+        car_apply_floor(car->car_mem, floor_str);
+    } else if (fleet_options->binary && strcmp(message, "PROTOCOL " BINARY_PROTOCOL) == 0) {
+        car->binary_active = 1;
+    } else if (strncmp(message, "FLOOR ", 6) == 0) {
+        car_apply_floor(car->car_mem, message + 6);
+    } else if (strncmp(message, ITINERARY_TOKEN " ", sizeof(ITINERARY_TOKEN)) == 0) {
+        // One stream, so itineraries arrive in version order and each replaces the last
+        int levels[ITINERARY_MAX_STOPS];
+        uint16_t version;
+        int count = parse_itinerary(message, &version, levels);
+        if (count >= 0) {
+            car_engine_set_itinerary(&car->engine, levels, count);
+        }
+    }
+}
+
+// Function to handle socket events for a car: a finished connection attempt, room to write,
+// or messages to read
+static void service_car(fleet_car *car, uint32_t events) {
+    if (car->state == SESSION_CONNECTING) {
+        if (connect_result(car->sockfd) == 0) {
+            open_session(car);
+        } else {
+            end_session(car, next_backoff(car));
+        }
+        return;
+    }
+    if (car->state != SESSION_OPEN) {
+        return;
+    }
+    if (events & EPOLLOUT) {
+        flush_car(car);
+        if (car->state != SESSION_OPEN) {
+            return;
+        }
+    }
+    if (!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+        return;
+    }
+
+    ssize_t n = frame_reader_fill(&car->rx, car->sockfd);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        end_session(car, rand_r(&car->worker->seed) % (car->delay + 1));  // Lost the controller
+        return;
+    }
+    if (n > 0) {
+        char *message;
+        size_t len;
+        int status;
+        car->last_rx_ms = monotonic_ms();
+        pthread_mutex_lock(&car->car_mem->mutex);
+        while ((status = frame_reader_next(&car->rx, &message, &len)) == 1) {
+            handle_message(car, message, len);
+        }
+        pthread_mutex_unlock(&car->car_mem->mutex);
+        if (status < 0) {
+            end_session(car, next_backoff(car));  // Oversized frame: the stream cannot be trusted
+            return;
+        }
+    }
+    update_car(car, 0);  // Act on new destinations straight away
+}
+
+// Function to handle an expired session timer
+static void session_timeout(fleet_car *car) {
+    switch (car->state) {
+    case SESSION_IDLE:
+        start_session(car);
+        break;
+    case SESSION_CONNECTING:
+        end_session(car, next_backoff(car));  // Gave up after CONNECT_TIMEOUT_MS
+        break;
+    case SESSION_OPEN:
+        if (monotonic_ms() - car->last_rx_ms >= (uint64_t)HEARTBEAT_MISSES * fleet_options->heartbeat_ms) {
+            end_session(car, rand_r(&car->worker->seed) % (car->delay + 1));  // Controller presumed hung
+        } else {
+            update_car(car, 0);  // Sends the idle STATUS if it is due and re-arms the timer
+        }
+        break;
+    }
+}
+
+// Worker thread: drives its cars' engines and sessions from one epoll set and one timer heap
+static void *fleet_worker_thread(void *arg) {
+    fleet_worker *worker = (fleet_worker *)arg;
+    struct epoll_event events[FLEET_MAX_EVENTS];
+
+    // Adopt each car's initial state, and spread the first connections over one delay as for
+    // a reconnection, so a large fleet does not overflow the controller's accept queue
+    uint64_t now = monotonic_ms();
+    for (int i = 0; i < worker->car_count; ++i) {
+        fleet_car *car = worker->cars[i];
+        update_car(car, 0);
+        schedule_session(car, now + rand_r(&worker->seed) % (car->delay + 1));
+    }
+    if (timer_schedule(&worker->timers, &worker->poll, now + FLEET_POLL_MS) != 0) {
+        perror("timer_schedule");
+        exit(EXIT_FAILURE);
+    }
+
+    while (fleet_running) {
+        timer *expired;
+        while ((expired = timer_pop_expired(&worker->timers, monotonic_ms())) != NULL) {
+            fleet_car *car = (fleet_car *)expired->data;
+            if (expired == &worker->poll) {
+                for (int i = 0; i < worker->car_count; ++i) {
+                    update_car(worker->cars[i], 0);
+                }
+                timer_schedule(&worker->timers, &worker->poll, monotonic_ms() + FLEET_POLL_MS);  // Cannot fail: it was just popped
+            } else if (expired == &car->engine.phase) {
+                update_car(car, 1);
+            } else {
+                session_timeout(car);
+            }
+        }
+
+        int n = epoll_wait(worker->epoll_fd, events, FLEET_MAX_EVENTS, timer_timeout_ms(&worker->timers, monotonic_ms()));
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr == &fleet_wake_fd) {
+                fleet_running = 0;  // Shutdown requested; the eventfd stays signalled for the others
+            } else {
+                service_car((fleet_car *)events[i].data.ptr, events[i].events);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Function to remove the cars' shared memory and close their sessions
+static void release_cars(fleet_car *cars, int count) {
+    for (int i = 0; i < count; ++i) {
+        if (cars[i].sockfd != -1) {
+            close(cars[i].sockfd);
+        }
+        if (cars[i].car_mem) {
+            unlink_shared_memory(cars[i].shm_name);
+            close_shared_memory(cars[i].car_mem);
+        }
+    }
+}
+
+int run_fleet(const char *spec, const car_options *options) {
+    fleet_car *cars;
+    int count = parse_spec(spec, &cars);
+    if (count < 0) {
+        return -1;
+    }
+    int worker_count = options->workers > 0 ? options->workers : FLEET_DEFAULT_WORKERS;
+    if (worker_count > FLEET_MAX_WORKERS) {
+        worker_count = FLEET_MAX_WORKERS;
+    }
+    if (worker_count > count) {
+        worker_count = count;
+    }
+    fleet_options = options;
+
+    fleet_worker *workers = calloc(worker_count, sizeof(fleet_worker));
+    fleet_car **slots = malloc(count * sizeof(fleet_car *));
+    fleet_wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (!workers || !slots || fleet_wake_fd == -1) {
+        perror("run_fleet");
+        exit(EXIT_FAILURE);
+    }
+
+    // Each worker drives every worker_count-th car
+    unsigned int seed = (unsigned int)getpid() ^ (unsigned int)monotonic_ms();
+    for (int w = 0; w < worker_count; ++w) {
+        fleet_worker *worker = &workers[w];
+        worker->epoll_fd = epoll_create1(0);
+        if (worker->epoll_fd == -1) {
+            perror("epoll_create1");
+            exit(EXIT_FAILURE);
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &fleet_wake_fd;
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fleet_wake_fd, &ev);
+        timer_heap_init(&worker->timers);
+        timer_init(&worker->poll, NULL);
+        worker->cars = slots + w * (count / worker_count) + (w < count % worker_count ? w : count % worker_count);
+        worker->seed = seed + w;
+    }
+
+    // Create every car's shared memory before starting, so a name clash stops the whole fleet
+    int status = 0;
+    for (int i = 0; i < count; ++i) {
+        fleet_car *car = &cars[i];
+        if (init_shared_memory(car->shm_name, &car->car_mem) != 0) {
+            fprintf(stderr, "Failed to create shared memory for car %s.\n", car->name);
+            car->car_mem = NULL;
+            status = -1;
+            break;
+        }
+        fleet_worker *worker = &workers[i % worker_count];
+        car->worker = worker;
+        car->backoff_ms = car->delay;
+        car_state_init(car->car_mem, car->lowest_floor);
+        car_engine_init(&car->engine, car->car_mem, car->lowest_floor, car->highest_floor, car->delay,
+                        fleet_options->motion.cruise_ms > 0 ? &fleet_options->motion : NULL, &worker->timers, car);
+        timer_init(&car->session, car);
+        worker->cars[worker->car_count++] = car;
+    }
+
+    if (status == 0) {
+        // SIGINT is taken here rather than by a worker, so block it before they start
+        sigset_t signals;
+        int sig;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+        signal(SIGPIPE, SIG_IGN);
+        for (int w = 0; w < worker_count; ++w) {
+            pthread_create(&workers[w].tid, NULL, fleet_worker_thread, &workers[w]);
+        }
+        printf("Fleet of %d car%s running on %d worker%s.\n", count, count == 1 ? "" : "s", worker_count, worker_count == 1 ? "" : "s");
+        fflush(stdout);
+
+        while (sigwait(&signals, &sig) != 0) {
+        }
+        uint64_t one = 1;
+        if (write(fleet_wake_fd, &one, sizeof(one)) != sizeof(one)) {
+            perror("write");
+        }
+        for (int w = 0; w < worker_count; ++w) {
+            pthread_join(workers[w].tid, NULL);
+        }
+    }
+
+    release_cars(cars, count);
+    for (int w = 0; w < worker_count; ++w) {
+        close(workers[w].epoll_fd);
+        timer_heap_free(&workers[w].timers);
+    }
+    close(fleet_wake_fd);
+    free(slots);
+    free(workers);
+    free(cars);
+    return status;
+}
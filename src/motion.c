@@ -0,0 +1,50 @@
+// motion.c
+
+#include "motion.h"
+#include <math.h>
+
+// With speed v = 1 / cruise and acceleration a = v / accel, the car covers accel / (2 * cruise)
+// floors while speeding up, and x floors from rest take sqrt(2 * x * cruise * accel)
+static double ramp_ms(const motion_profile *profile, double floors) {
+    return sqrt(2.0 * floors * profile->cruise_ms * profile->accel_ms);
+}
+
+static double trip_ms(const motion_profile *profile, int floors) {
+    if (floors * profile->cruise_ms >= profile->accel_ms) {
+        return (double)floors * profile->cruise_ms + profile->accel_ms;  // Reaches cruising speed
+    }
+    return 2.0 * ramp_ms(profile, floors / 2.0);
+}
+
+uint64_t motion_trip_ms(const motion_profile *profile, int floors) {
+    if (floors <= 0) {
+        return 0;
+    }
+    return (uint64_t)(trip_ms(profile, floors) + 0.5);
+}
+
+uint64_t motion_pass_ms(const motion_profile *profile, int floors, int passed) {
+    if (passed <= 0) {
+        return 0;
+    }
+    if (passed > floors) {
+        passed = floors;
+    }
+    if (profile->accel_ms <= 0) {
+        return (uint64_t)passed * profile->cruise_ms;
+    }
+
+    double ramp_floors = profile->accel_ms / (2.0 * profile->cruise_ms);
+    if (ramp_floors > floors / 2.0) {
+        ramp_floors = floors / 2.0;  // Brakes before reaching cruising speed
+    }
+    double t;
+    if (passed <= ramp_floors) {
+        t = ramp_ms(profile, passed);
+    } else if (passed >= floors - ramp_floors) {
+        t = trip_ms(profile, floors) - ramp_ms(profile, floors - passed);
+    } else {
+        t = profile->accel_ms + (passed - ramp_floors) * profile->cruise_ms;
+    }
+    return (uint64_t)(t + 0.5);
+}
@@ -1,16 +1,99 @@
 #include "network.h"   // Include network-related function declarations
 #include <stdio.h>      // Standard I/O library for printing error messages
 #include <stdlib.h>     // Standard library for memory allocation and process control
+#include <stddef.h>     // offsetof() for Unix socket address lengths
 #include <string.h>     // String manipulation functions
 #include <unistd.h>     // UNIX standard library for system calls (like close())
 #include <fcntl.h>      // File control options (used for socket manipulation)
 #include <arpa/inet.h>  // Functions for internet operations (like inet_pton)
+#include <errno.h>      // Error numbers (EAGAIN from non-blocking sends)
+#include <sys/socket.h> // send() and its flags
+#include <sys/uio.h>    // writev() for single-syscall frames
+#include <netinet/in.h> // IPPROTO_TCP
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <poll.h>       // poll() to bound connection attempts
+
+// Function to fill in a Unix socket address for a path ('@' prefix = abstract namespace)
+int unix_address(const char *path, struct sockaddr_un *addr, socklen_t *len) {
+    size_t path_len = strlen(path);
+    if (path_len == 0 || path_len >= sizeof(addr->sun_path)) {
+        return -1;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, path, path_len);
+    if (path[0] == '@') {
+        addr->sun_path[0] = '\0';  // Abstract: the name is the bytes after the leading NUL
+        *len = offsetof(struct sockaddr_un, sun_path) + path_len;
+    } else {
+        *len = offsetof(struct sockaddr_un, sun_path) + path_len + 1;
+    }
+    return 0;
+}
+
+// Function to connect a blocking socket, giving up after timeout_ms instead of waiting out the
+// kernel's SYN retries when the controller's backlog is full. Returns 0 or -1.
+static int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr_len, int timeout_ms) {
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    if (flags == -1 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        return -1;
+    }
+
+    int result = connect(sockfd, addr, addr_len);
+    if (result != 0 && errno == EINPROGRESS) {
+        // Wait for the handshake to finish, then collect its outcome
+        struct pollfd pfd = { sockfd, POLLOUT, 0 };
+        int ready;
+        do {
+            ready = poll(&pfd, 1, timeout_ms);
+        } while (ready == -1 && errno == EINTR);
+
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        if (ready == 1 && getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &error_len) == 0 && error == 0) {
+            result = 0;
+        }
+    }
+
+    // Refused, timed out, or (for Unix sockets) EAGAIN from a full backlog all count as failures
+    if (result != 0 || fcntl(sockfd, F_SETFL, flags) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+// Function to connect to the controller over a Unix domain socket
+static int connect_unix(const char *path) {
+    struct sockaddr_un addr;
+    socklen_t addr_len;
+    if (unix_address(path, &addr, &addr_len) != 0) {
+        return -1;
+    }
+
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd == -1) {
+        perror("socket");
+        return -1;
+    }
+    if (connect_with_timeout(sockfd, (struct sockaddr *)&addr, addr_len, CONNECT_TIMEOUT_MS) != 0) {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
 
 // Function to establish a connection to the elevator controller
 int connect_to_controller() {
     int sockfd;  // Socket file descriptor
     struct sockaddr_in serv_addr;  // Structure to hold the server's address
 
+    // Co-located processes can skip the TCP stack entirely
+    const char *path = getenv(CONTROLLER_SOCKET_ENV);
+    if (path && *path) {
+        return connect_unix(path);
+    }
+
     // Create a socket for communication over IPv4 and TCP
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd == -1) {  // Check if socket creation failed
@@ -30,67 +113,347 @@ int connect_to_controller() {
         return -1;            // Return an error code
     }
 
-    // Attempt to connect to the controller
-    if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) != 0) {
+    // Attempt to connect to the controller, bounded by CONNECT_TIMEOUT_MS
+    if (connect_with_timeout(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr), CONNECT_TIMEOUT_MS) != 0) {
         close(sockfd);  // Close the socket if the connection fails
         return -1;      // Return an error code
     }
 
+    set_nodelay(sockfd);  // Frames are small and latency-sensitive
+
     return sockfd;  // Return the socket file descriptor if successful
 }
 
-// Function to send a message over a socket
+// Function to start connecting a non-blocking socket to the controller, for callers that wait
+// for many connections at once
+int connect_to_controller_nonblocking(int *in_progress) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int domain;
+
+    memset(&addr, 0, sizeof(addr));
+    const char *path = getenv(CONTROLLER_SOCKET_ENV);
+    if (path && *path) {
+        if (unix_address(path, (struct sockaddr_un *)&addr, &addr_len) != 0) {
+            return -1;
+        }
+        domain = AF_UNIX;
+    } else {
+        struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(CONTROLLER_PORT);
+        if (inet_pton(AF_INET, CONTROLLER_IP, &in->sin_addr) <= 0) {
+            return -1;
+        }
+        addr_len = sizeof(*in);
+        domain = AF_INET;
+    }
+
+    int sockfd = socket(domain, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sockfd == -1) {
+        perror("socket");
+        return -1;
+    }
+    if (domain == AF_INET) {
+        set_nodelay(sockfd);
+    }
+
+    *in_progress = 0;
+    if (connect(sockfd, (struct sockaddr *)&addr, addr_len) != 0) {
+        if (errno != EINPROGRESS) {
+            close(sockfd);  // Refused, or EAGAIN from a full Unix socket backlog
+            return -1;
+        }
+        *in_progress = 1;
+    }
+    return sockfd;
+}
+
+// Function to collect the outcome of a non-blocking connection once its socket is writable
+int connect_result(int sockfd) {
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &error_len) != 0 || error != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Function to write every byte described by an iovec array, resuming after partial writes.
+// The array is updated in place as data goes out.
+static int write_all(int sockfd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(sockfd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        // Skip the buffers that were written completely, then trim the partially written one
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Function to send a message over a socket as a single length-prefixed frame
 int send_message(int sockfd, const char *message) {
-    // Get the length of the message and convert it to network byte order
-    uint32_t len = htonl(strlen(message));
+    return send_messages(sockfd, &message, 1);
+}
+
+// Function to send several messages in one system call, so they can share a TCP segment
+int send_messages(int sockfd, const char *const *messages, int count) {
+    struct iovec iov[2 * MAX_CORKED_FRAMES];
+    uint32_t len_net[MAX_CORKED_FRAMES];
 
-    // Send the length of the message first
-    if (write(sockfd, &len, sizeof(len)) != sizeof(len)) {
-        return -1;  // Return an error if the length couldn't be sent
+    if (count < 0 || count > MAX_CORKED_FRAMES) {
+        return -1;
     }
 
-    // Send the actual message
-    if (write(sockfd, message, strlen(message)) != (ssize_t)strlen(message)) {
-        return -1;  // Return an error if the message couldn't be sent completely
+    // Each frame is its length (in network byte order) followed by the message itself
+    for (int i = 0; i < count; ++i) {
+        size_t len = strlen(messages[i]);
+        len_net[i] = htonl(len);
+        iov[2 * i].iov_base = &len_net[i];
+        iov[2 * i].iov_len = sizeof(len_net[i]);
+        iov[2 * i + 1].iov_base = (void *)messages[i];
+        iov[2 * i + 1].iov_len = len;
     }
+    return write_all(sockfd, iov, 2 * count);
+}
 
-    return 0;  // Return success
+// Function to send raw bytes as one length-prefixed frame
+int send_frame(int sockfd, const void *data, size_t len) {
+    uint32_t len_net = htonl(len);
+    struct iovec iov[2];
+    iov[0].iov_base = &len_net;
+    iov[0].iov_len = sizeof(len_net);
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = len;
+    return write_all(sockfd, iov, 2);
 }
 
-// Function to receive a message from a socket
-int receive_message(int sockfd, char **message) {
-    uint32_t len_net;  // Variable to hold the length of the incoming message (in network byte order)
+static const char *const status_names[BIN_STATUS_COUNT] = { "Closed", "Opening", "Open", "Closing", "Between" };
 
-    // Read the length of the message first
-    ssize_t n = read(sockfd, &len_net, sizeof(len_net));
-    if (n == 0) {
-        return -1;  // Return an error if the connection was closed
+// Function to get the status code for a status string
+int status_code(const char *status) {
+    for (int i = 0; i < BIN_STATUS_COUNT; ++i) {
+        if (strcmp(status, status_names[i]) == 0) {
+            return i;
+        }
     }
-    if (n != sizeof(len_net)) {
-        return -1;  // Return an error if we couldn't read the full length
+    return -1;
+}
+
+// Function to get the status string for a status code
+const char *status_name(int code) {
+    return (code >= 0 && code < BIN_STATUS_COUNT) ? status_names[code] : NULL;
+}
+
+// Store and load big-endian 16-bit fields
+static void put16(unsigned char *p, uint16_t v) {
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+static uint16_t get16(const char *p) {
+    return (uint16_t)(((unsigned char)p[0] << 8) | (unsigned char)p[1]);
+}
+
+// Function to build a binary STATUS frame
+void encode_bin_status(unsigned char *frame, int status, uint16_t seq, int current, int destination) {
+    frame[0] = BIN_STATUS_FRAME;
+    frame[1] = (unsigned char)status;
+    put16(frame + 2, seq);
+    put16(frame + 4, (uint16_t)(int16_t)current);
+    put16(frame + 6, (uint16_t)(int16_t)destination);
+}
+
+// Function to parse a binary STATUS frame
+int decode_bin_status(const char *frame, size_t len, int *status, uint16_t *seq, int *current, int *destination) {
+    if (len != BIN_STATUS_SIZE || (unsigned char)frame[0] != BIN_STATUS_FRAME ||
+        (unsigned char)frame[1] >= BIN_STATUS_COUNT) {
+        return -1;
     }
+    *status = (unsigned char)frame[1];
+    *seq = get16(frame + 2);
+    *current = (int16_t)get16(frame + 4);
+    *destination = (int16_t)get16(frame + 6);
+    return 0;
+}
 
-    // Convert the length from network byte order to host byte order
-    uint32_t len = ntohl(len_net);
+// Function to build a binary FLOOR frame
+void encode_bin_floor(unsigned char *frame, uint16_t seq, int floor) {
+    frame[0] = BIN_FLOOR_FRAME;
+    frame[1] = 0;
+    put16(frame + 2, seq);
+    put16(frame + 4, (uint16_t)(int16_t)floor);
+}
 
-    // Allocate memory for the message (including space for the null terminator)
-    *message = malloc(len + 1);
-    if (*message == NULL) {
-        return -1;  // Return an error if memory allocation failed
+// Function to parse a binary FLOOR frame
+int decode_bin_floor(const char *frame, size_t len, uint16_t *seq, int *floor) {
+    if (len != BIN_FLOOR_SIZE || (unsigned char)frame[0] != BIN_FLOOR_FRAME) {
+        return -1;
     }
+    *seq = get16(frame + 2);
+    *floor = (int16_t)get16(frame + 4);
+    return 0;
+}
 
-    // Read the message data in a loop (since it may arrive in fragments)
-    size_t total_read = 0;
-    while (total_read < len) {
-        n = read(sockfd, *message + total_read, len - total_read);  // Read a portion of the message
-        if (n <= 0) {
-            free(*message);  // Free the allocated memory if an error occurs
-            return -1;       // Return an error
+// Function to turn off Nagle's algorithm, so small frames go out without waiting for ACKs
+void set_nodelay(int sockfd) {
+    int enable = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+}
+
+// Function to initialise an empty outbound queue
+void tx_queue_init(tx_queue *q) {
+    q->len = 0;
+    q->sent = 0;
+    q->last_start = 0;
+    q->last_supersedes = 0;
+}
+
+// Function to queue a message as a length-prefixed frame
+int tx_queue_push(tx_queue *q, const char *message, int supersede) {
+    return tx_queue_push_frame(q, message, strlen(message), supersede);
+}
+
+// Function to queue raw bytes as a length-prefixed frame
+int tx_queue_push_frame(tx_queue *q, const void *data, size_t msg_len, int supersede) {
+    // Replace the previous superseding frame if none of it has been written yet
+    if (supersede && q->last_supersedes && q->last_start >= q->sent && q->last_start < q->len) {
+        q->len = q->last_start;
+    }
+
+    // Reclaim the space taken by frames that have already gone out
+    if (q->sent > 0) {
+        memmove(q->buf, q->buf + q->sent, q->len - q->sent);
+        q->len -= q->sent;
+        q->last_start = q->last_start > q->sent ? q->last_start - q->sent : 0;
+        q->sent = 0;
+    }
+
+    if (q->len + sizeof(uint32_t) + msg_len > sizeof(q->buf)) {
+        return -1;  // The peer is not keeping up
+    }
+
+    uint32_t len_net = htonl(msg_len);
+    q->last_start = q->len;
+    q->last_supersedes = supersede;
+    memcpy(q->buf + q->len, &len_net, sizeof(len_net));
+    memcpy(q->buf + q->len + sizeof(len_net), data, msg_len);
+    q->len += sizeof(len_net) + msg_len;
+    return 0;
+}
+
+// Function to write as much of the queue as the socket accepts without blocking
+int tx_queue_flush(tx_queue *q, int sockfd) {
+    while (q->sent < q->len) {
+        ssize_t n = send(sockfd, q->buf + q->sent, q->len - q->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
         }
-        total_read += n;  // Update the number of bytes read
+        q->sent += n;
+    }
+    q->len = 0;
+    q->sent = 0;
+    q->last_start = 0;
+    return 0;
+}
+
+// Function to check whether anything is waiting to be sent
+int tx_queue_empty(const tx_queue *q) {
+    return q->sent == q->len;
+}
+
+// Put back the byte the previous frame's terminator replaced
+static void frame_reader_release(frame_reader *r) {
+    if (r->holding) {
+        r->buf[r->held] = r->saved;
+        r->holding = 0;
+    }
+}
+
+// Function to initialise an empty frame reader
+void frame_reader_init(frame_reader *r) {
+    r->start = 0;
+    r->end = 0;
+    r->holding = 0;
+}
+
+// Function to make room after the received bytes by moving the partial frame left over from
+// the last read to the front
+static void frame_reader_compact(frame_reader *r) {
+    frame_reader_release(r);
+    if (r->start > 0) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+    }
+}
+
+// Function to read whatever the socket has available with one read()
+ssize_t frame_reader_fill(frame_reader *r, int sockfd) {
+    frame_reader_compact(r);
+
+    ssize_t n = read(sockfd, r->buf + r->end, FRAME_READER_SIZE - r->end);
+    if (n > 0) {
+        r->end += n;
+    }
+    return n;
+}
+
+// Function to copy in bytes that were received elsewhere (e.g. into an io_uring buffer)
+size_t frame_reader_feed(frame_reader *r, const void *data, size_t len) {
+    frame_reader_compact(r);
+
+    size_t room = FRAME_READER_SIZE - r->end;
+    if (len > room) {
+        len = room;
     }
+    memcpy(r->buf + r->end, data, len);
+    r->end += len;
+    return len;
+}
+
+// Function to take the next complete frame from the buffer
+int frame_reader_next(frame_reader *r, char **message, size_t *len) {
+    frame_reader_release(r);
 
-    (*message)[len] = '\0';  // Null-terminate the message
+    size_t available = r->end - r->start;
+    if (available < sizeof(uint32_t)) {
+        return 0;
+    }
+    uint32_t len_net;
+    memcpy(&len_net, r->buf + r->start, sizeof(len_net));
+    uint32_t frame_len = ntohl(len_net);
+    if (frame_len > MAX_FRAME_SIZE) {
+        return -1;
+    }
+    if (available - sizeof(uint32_t) < frame_len) {
+        return 0;  // Wait for the rest of the frame
+    }
 
-    return 0;  // Return success
+    // Terminate the body in place, remembering the byte (the next frame's header) underneath
+    *message = r->buf + r->start + sizeof(uint32_t);
+    *len = frame_len;
+    r->held = r->start + sizeof(uint32_t) + frame_len;
+    r->saved = r->buf[r->held];
+    r->buf[r->held] = '\0';
+    r->holding = 1;
+    r->start = r->held;
+    return 1;
 }
@@ -0,0 +1,144 @@
+// registry.c
+
+#include "registry.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Slot header stored in front of every record. The generation is odd while the slot is
+// live and even while it is free; it is bumped on every allocation and release.
+struct registry_slot {
+    _Atomic uint32_t generation;
+    uint32_t next_free;  // Next free slot index + 1 while on the free list
+};
+
+// Records start at a max_align_t boundary after the header
+#define SLOT_HEADER_SIZE ((sizeof(registry_slot) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+static registry_slot *slot_at(registry *reg, uint32_t index) {
+    unsigned char *chunk = __atomic_load_n(&reg->chunks[index / REGISTRY_CHUNK_SLOTS], __ATOMIC_ACQUIRE);
+    return (registry_slot *)(chunk + (size_t)(index % REGISTRY_CHUNK_SLOTS) * reg->slot_size);
+}
+
+static void *record_of(registry_slot *slot) {
+    return (unsigned char *)slot + SLOT_HEADER_SIZE;
+}
+
+static registry_handle make_handle(uint32_t generation, uint32_t index) {
+    return ((registry_handle)generation << 32) | index;
+}
+
+void registry_init(registry *reg, size_t record_size, void (*construct)(void *record)) {
+    memset(reg, 0, sizeof(*reg));
+    reg->record_size = record_size;
+    reg->slot_size = (SLOT_HEADER_SIZE + record_size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+    reg->construct = construct;
+    pthread_mutex_init(&reg->mutex, NULL);
+}
+
+// Add one chunk of free slots. Called with reg->mutex held.
+static int registry_grow(registry *reg) {
+    uint32_t chunk_index = reg->capacity / REGISTRY_CHUNK_SLOTS;
+    if (chunk_index >= REGISTRY_MAX_CHUNKS) {
+        return -1;
+    }
+
+    unsigned char *chunk = calloc(REGISTRY_CHUNK_SLOTS, reg->slot_size);
+    if (!chunk) {
+        return -1;
+    }
+
+    // Construct the records and thread the new slots onto the free list in index order
+    for (uint32_t i = REGISTRY_CHUNK_SLOTS; i-- > 0;) {
+        registry_slot *slot = (registry_slot *)(chunk + (size_t)i * reg->slot_size);
+        atomic_init(&slot->generation, 0);
+        slot->next_free = reg->free_head;
+        reg->free_head = reg->capacity + i + 1;
+        if (reg->construct) {
+            reg->construct(record_of(slot));
+        }
+    }
+
+    // Publish the chunk before the capacity that makes it reachable
+    __atomic_store_n(&reg->chunks[chunk_index], chunk, __ATOMIC_RELEASE);
+    __atomic_store_n(&reg->capacity, reg->capacity + REGISTRY_CHUNK_SLOTS, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void *registry_alloc(registry *reg, registry_handle *handle) {
+    pthread_mutex_lock(&reg->mutex);
+    if (reg->free_head == 0 && registry_grow(reg) != 0) {
+        pthread_mutex_unlock(&reg->mutex);
+        return NULL;
+    }
+
+    uint32_t index = reg->free_head - 1;
+    registry_slot *slot = slot_at(reg, index);
+    reg->free_head = slot->next_free;
+    slot->next_free = 0;
+    __atomic_add_fetch(&reg->live, 1, __ATOMIC_RELAXED);
+
+    // Even -> odd: the slot is now live under a generation no earlier handle carries
+    uint32_t generation = atomic_fetch_add(&slot->generation, 1) + 1;
+    pthread_mutex_unlock(&reg->mutex);
+
+    *handle = make_handle(generation, index);
+    return record_of(slot);
+}
+
+void registry_release(registry *reg, registry_handle handle) {
+    uint32_t index = (uint32_t)handle;
+    uint32_t generation = (uint32_t)(handle >> 32);
+
+    pthread_mutex_lock(&reg->mutex);
+    if (index < reg->capacity) {
+        registry_slot *slot = slot_at(reg, index);
+        uint32_t expected = generation;
+        // Odd -> even; a stale or already released handle leaves the slot untouched
+        if (atomic_compare_exchange_strong(&slot->generation, &expected, generation + 1)) {
+            slot->next_free = reg->free_head;
+            reg->free_head = index + 1;
+            __atomic_sub_fetch(&reg->live, 1, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&reg->mutex);
+}
+
+void *registry_get(registry *reg, registry_handle handle) {
+    uint32_t index = (uint32_t)handle;
+    uint32_t generation = (uint32_t)(handle >> 32);
+
+    if (handle == REGISTRY_NO_HANDLE || index >= registry_capacity(reg)) {
+        return NULL;
+    }
+    registry_slot *slot = slot_at(reg, index);
+    if (atomic_load(&slot->generation) != generation) {
+        return NULL;
+    }
+    return record_of(slot);
+}
+
+int registry_is_live(registry *reg, registry_handle handle) {
+    return registry_get(reg, handle) != NULL;
+}
+
+uint32_t registry_capacity(registry *reg) {
+    return __atomic_load_n(&reg->capacity, __ATOMIC_ACQUIRE);
+}
+
+void *registry_slot_record(registry *reg, uint32_t index, registry_handle *handle) {
+    if (index >= registry_capacity(reg)) {
+        return NULL;
+    }
+    registry_slot *slot = slot_at(reg, index);
+    uint32_t generation = atomic_load(&slot->generation);
+    if ((generation & 1) == 0) {
+        return NULL;  // Free slot
+    }
+    *handle = make_handle(generation, index);
+    return record_of(slot);
+}
+
+uint32_t registry_count(registry *reg) {
+    return __atomic_load_n(&reg->live, __ATOMIC_RELAXED);
+}
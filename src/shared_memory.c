@@ -7,6 +7,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 int init_shared_memory(const char *shm_name, car_shared_mem **car_mem) {
     int shm_fd;
@@ -79,6 +80,15 @@ int init_shared_memory(const char *shm_name, car_shared_mem **car_mem) {
         shm_unlink(shm_name);
         return -1;
     }
+    // Timed waits on the condition variable use the monotonic clock
+    if (pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC) != 0) {
+        perror("pthread_condattr_setclock");
+        pthread_condattr_destroy(&cond_attr);
+        pthread_mutex_destroy(&(*car_mem)->mutex);
+        munmap(*car_mem, sizeof(car_shared_mem));
+        shm_unlink(shm_name);
+        return -1;
+    }
 
     // condition variable
     if (pthread_cond_init(&(*car_mem)->cond, &cond_attr) != 0) {
@@ -0,0 +1,191 @@
+// shm_link.c
+
+#include "shm_link.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+// The segment is shared between processes, so these are not FUTEX_PRIVATE_FLAG operations.
+// FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC deadline.
+static int futex_wait_until(uint32_t *word, uint32_t expected, const struct timespec *deadline) {
+    return (int)syscall(SYS_futex, word, FUTEX_WAIT_BITSET, expected, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+static void futex_wake(uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static int ring_ready(shm_ring *ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_RELAXED) != __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+}
+
+static int link_closed(shm_link *link) {
+    return __atomic_load_n(&link->closed, __ATOMIC_SEQ_CST) != 0;
+}
+
+static void wake_consumer(shm_ring *ring) {
+    __atomic_add_fetch(&ring->wake_seq, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&ring->wake_seq);
+}
+
+int shm_link_name(const char *car_name, char *out, size_t size) {
+    int n = snprintf(out, size, SHM_LINK_PREFIX "%s", car_name);
+    return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+int shm_link_create(const char *shm_name, shm_link **link) {
+    shm_unlink(shm_name);  // Left behind by a car that did not exit cleanly
+    int shm_fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (shm_fd == -1) {
+        perror("shm_open");
+        return -1;
+    }
+    if (ftruncate(shm_fd, sizeof(shm_link)) == -1) {
+        perror("ftruncate");
+        close(shm_fd);
+        shm_unlink(shm_name);
+        return -1;
+    }
+    *link = mmap(NULL, sizeof(shm_link), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (*link == MAP_FAILED) {
+        perror("mmap");
+        shm_unlink(shm_name);
+        return -1;
+    }
+
+    memset(*link, 0, sizeof(shm_link));
+    __atomic_store_n(&(*link)->magic, SHM_LINK_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int shm_link_open(const char *shm_name, shm_link **link) {
+    // Not finding the segment is expected when the car runs on another host
+    int shm_fd = shm_open(shm_name, O_RDWR, 0);
+    if (shm_fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(shm_fd, &st) == -1 || (size_t)st.st_size < sizeof(shm_link)) {
+        close(shm_fd);
+        return -1;
+    }
+    *link = mmap(NULL, sizeof(shm_link), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (*link == MAP_FAILED) {
+        return -1;
+    }
+    if (__atomic_load_n(&(*link)->magic, __ATOMIC_ACQUIRE) != SHM_LINK_MAGIC || link_closed(*link)) {
+        munmap(*link, sizeof(shm_link));
+        return -1;
+    }
+    return 0;
+}
+
+void shm_link_close(shm_link *link) {
+    munmap(link, sizeof(shm_link));
+}
+
+void shm_link_unlink(const char *shm_name) {
+    shm_unlink(shm_name);
+}
+
+void shm_link_shut(shm_link *link) {
+    __atomic_store_n(&link->closed, 1, __ATOMIC_SEQ_CST);
+    wake_consumer(&link->to_controller);
+    wake_consumer(&link->to_car);
+}
+
+int shm_ring_push(shm_link *link, shm_ring *ring, const char *message) {
+    size_t len = strlen(message);
+    if (len >= SHM_MESSAGE_SIZE || link_closed(link)) {
+        return -1;
+    }
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= SHM_RING_SLOTS) {
+        return -1;
+    }
+
+    shm_message *slot = &ring->slots[tail & (SHM_RING_SLOTS - 1)];
+    memcpy(slot->data, message, len + 1);
+    slot->len = (uint32_t)len;
+
+    // Publishing the tail and then checking `waiting` pairs with the consumer setting `waiting`
+    // and then checking the tail: at least one side sees the other, so no wakeup is lost
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST)) {
+        wake_consumer(ring);
+    }
+    return 0;
+}
+
+int shm_ring_pop(shm_ring *ring, char *message, size_t size) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    // The length comes from the other process, so bound it before copying
+    shm_message *slot = &ring->slots[head & (SHM_RING_SLOTS - 1)];
+    size_t len = slot->len;
+    if (len > SHM_MESSAGE_SIZE - 1) len = SHM_MESSAGE_SIZE - 1;
+    if (len > size - 1) len = size - 1;
+    memcpy(message, slot->data, len);
+    message[len] = '\0';
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int shm_ring_wait(shm_link *link, shm_ring *ring, int timeout_ms) {
+    for (int i = 0; i < SHM_SPIN_POLLS; ++i) {
+        if (ring_ready(ring)) return 1;
+        if (link_closed(link)) return -1;
+        cpu_relax();
+    }
+
+    struct timespec deadline;
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    int result;
+    for (;;) {
+        // Announce the sleep before the final check (see shm_ring_push); reading wake_seq
+        // first means a wakeup sent after the check makes the futex wait return at once
+        __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+        uint32_t seq = __atomic_load_n(&ring->wake_seq, __ATOMIC_SEQ_CST);
+        if (ring_ready(ring)) {
+            result = 1;
+            break;
+        }
+        if (link_closed(link)) {
+            result = -1;
+            break;
+        }
+        if (futex_wait_until(&ring->wake_seq, seq, timeout_ms >= 0 ? &deadline : NULL) == -1 && errno == ETIMEDOUT) {
+            result = ring_ready(ring);
+            break;
+        }
+    }
+    __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+    return result;
+}
@@ -0,0 +1,465 @@
+// stop_set.c
+
+#include "stop_set.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DIR_UP 1
+#define DIR_DOWN -1
+#define DIR_IDLE 0
+
+// Combine the selected bitmaps for one 64-level word
+static uint64_t word_of(const stop_bits *bits, int which, int w) {
+    uint64_t word = 0;
+    if (which & STOPS_UP) word |= bits->up[w];
+    if (which & STOPS_DOWN) word |= bits->down[w];
+    if (which & STOPS_CAR) word |= bits->car[w];
+    if (which & STOPS_PLANNED) word |= bits->planned[w];
+    return word;
+}
+
+// Mask of the bits lo..hi (inclusive, 0..63) within a word
+static uint64_t range_mask(int lo, int hi) {
+    uint64_t upper = (hi >= 63) ? ~0ULL : ((1ULL << (hi + 1)) - 1);
+    return upper & (~0ULL << lo);
+}
+
+// Lowest set index in [lo, hi] across the selected bitmaps, or -1
+static int lowest_in(const stop_bits *bits, int which, int lo, int hi) {
+    if (lo < 0) lo = 0;
+    if (hi > bits->levels - 1) hi = bits->levels - 1;
+    for (int w = lo / 64; lo <= hi && w <= hi / 64; ++w) {
+        int from = (w == lo / 64) ? lo % 64 : 0;
+        int to = (w == hi / 64) ? hi % 64 : 63;
+        uint64_t word = word_of(bits, which, w) & range_mask(from, to);
+        if (word) {
+            return w * 64 + __builtin_ctzll(word);
+        }
+    }
+    return -1;
+}
+
+// Highest set index in [lo, hi] across the selected bitmaps, or -1
+static int highest_in(const stop_bits *bits, int which, int lo, int hi) {
+    if (lo < 0) lo = 0;
+    if (hi > bits->levels - 1) hi = bits->levels - 1;
+    for (int w = hi / 64; lo <= hi && w >= lo / 64; --w) {
+        int from = (w == lo / 64) ? lo % 64 : 0;
+        int to = (w == hi / 64) ? hi % 64 : 63;
+        uint64_t word = word_of(bits, which, w) & range_mask(from, to);
+        if (word) {
+            return w * 64 + 63 - __builtin_clzll(word);
+        }
+    }
+    return -1;
+}
+
+static int test_bit(const uint64_t *map, int i) {
+    return (map[i / 64] >> (i % 64)) & 1;
+}
+
+static void set_bit(uint64_t *map, int i) {
+    map[i / 64] |= 1ULL << (i % 64);
+}
+
+static void clear_bit(uint64_t *map, int i) {
+    map[i / 64] &= ~(1ULL << (i % 64));
+}
+
+void stop_bits_init(stop_bits *bits, int lowest, int highest) {
+    memset(bits, 0, sizeof(*bits));
+    bits->lowest = lowest;
+    bits->levels = highest - lowest + 1;
+    if (bits->levels < 1) bits->levels = 1;
+    if (bits->levels > STOP_SET_MAX_LEVELS) bits->levels = STOP_SET_MAX_LEVELS;
+}
+
+int stop_bits_test(const stop_bits *bits, int which, int level) {
+    int i = level - bits->lowest;
+    if (i < 0 || i >= bits->levels) {
+        return 0;
+    }
+    return (word_of(bits, which, i / 64) >> (i % 64)) & 1;
+}
+
+int stop_bits_count(const stop_bits *bits, int which) {
+    int count = 0;
+    for (int w = 0; w <= (bits->levels - 1) / 64; ++w) {
+        count += __builtin_popcountll(word_of(bits, which, w));
+    }
+    return count;
+}
+
+int stop_bits_next(const stop_bits *bits, int position, int *direction) {
+    int p = position - bits->lowest;
+    int top = bits->levels - 1;
+    int s;
+    if (p < 0) p = 0;
+    if (p > top) p = top;
+
+    if (*direction == DIR_UP) {
+        // Stops ahead in this direction, then the highest down call to turn around at
+        if ((s = lowest_in(bits, STOPS_UP | STOPS_CAR, p, top)) >= 0) return bits->lowest + s;
+        if ((s = highest_in(bits, STOPS_DOWN, p, top)) >= 0) return bits->lowest + s;
+        // Nothing above: reverse
+        *direction = DIR_DOWN;
+        if ((s = highest_in(bits, STOPS_DOWN | STOPS_CAR, 0, p)) >= 0) return bits->lowest + s;
+        if ((s = lowest_in(bits, STOPS_UP, 0, p)) >= 0) return bits->lowest + s;
+    } else if (*direction == DIR_DOWN) {
+        if ((s = highest_in(bits, STOPS_DOWN | STOPS_CAR, 0, p)) >= 0) return bits->lowest + s;
+        if ((s = lowest_in(bits, STOPS_UP, 0, p)) >= 0) return bits->lowest + s;
+        *direction = DIR_UP;
+        if ((s = lowest_in(bits, STOPS_UP | STOPS_CAR, p, top)) >= 0) return bits->lowest + s;
+        if ((s = highest_in(bits, STOPS_DOWN, p, top)) >= 0) return bits->lowest + s;
+    } else {
+        // Idle: head for the nearest stop (upwards on a tie)
+        int above = lowest_in(bits, STOPS_ALL, p, top);
+        int below = highest_in(bits, STOPS_ALL, 0, p);
+        if (above < 0 && below < 0) {
+            return STOP_NONE;
+        }
+        s = (below < 0 || (above >= 0 && above - p <= p - below)) ? above : below;
+        if (s > p) {
+            *direction = DIR_UP;
+        } else if (s < p) {
+            *direction = DIR_DOWN;
+        } else if (test_bit(bits->up, s)) {
+            *direction = DIR_UP;     // Stop here, then carry the passenger up
+        } else if (test_bit(bits->down, s)) {
+            *direction = DIR_DOWN;
+        }
+        return bits->lowest + s;
+    }
+
+    *direction = DIR_IDLE;
+    return STOP_NONE;
+}
+
+int stop_bits_arrive(stop_bits *bits, int level, int *direction) {
+    int i = level - bits->lowest;
+    int top = bits->levels - 1;
+    int boarded = 0;
+    if (i < 0 || i > top) {
+        return 0;
+    }
+
+    clear_bit(bits->car, i);
+
+    if (*direction == DIR_UP) {
+        if (test_bit(bits->up, i)) {
+            clear_bit(bits->up, i);
+            boarded |= STOPS_UP;
+        }
+        // Turn around here if nothing is left above and nobody just boarded going up
+        if (!(boarded & STOPS_UP) && lowest_in(bits, STOPS_ALL, i + 1, top) < 0) {
+            if (test_bit(bits->down, i)) {
+                clear_bit(bits->down, i);
+                boarded |= STOPS_DOWN;
+            }
+            *direction = (boarded & STOPS_DOWN) || highest_in(bits, STOPS_ALL, 0, i - 1) >= 0 ? DIR_DOWN : DIR_IDLE;
+        }
+    } else if (*direction == DIR_DOWN) {
+        if (test_bit(bits->down, i)) {
+            clear_bit(bits->down, i);
+            boarded |= STOPS_DOWN;
+        }
+        if (!(boarded & STOPS_DOWN) && highest_in(bits, STOPS_ALL, 0, i - 1) < 0) {
+            if (test_bit(bits->up, i)) {
+                clear_bit(bits->up, i);
+                boarded |= STOPS_UP;
+            }
+            *direction = (boarded & STOPS_UP) || lowest_in(bits, STOPS_ALL, i + 1, top) >= 0 ? DIR_UP : DIR_IDLE;
+        }
+    } else {
+        // An idle car takes everyone waiting at this level
+        if (test_bit(bits->up, i)) {
+            clear_bit(bits->up, i);
+            boarded |= STOPS_UP;
+        }
+        if (test_bit(bits->down, i)) {
+            clear_bit(bits->down, i);
+            boarded |= STOPS_DOWN;
+        }
+    }
+    return boarded;
+}
+
+void stop_set_init(stop_set *set, int lowest, int highest) {
+    stop_bits_init(&set->bits, lowest, highest);
+    set->direction = DIR_IDLE;
+    set->pending_count = 0;
+}
+
+// Drop the pending index; it is rebuilt by the next call added
+static void free_index(stop_set *set) {
+    free(set->hash);
+    free(set->level_index);
+    set->hash = NULL;
+    set->hash_mask = 0;
+    set->level_index = NULL;
+}
+
+void stop_set_free(stop_set *set) {
+    free(set->pending);
+    set->pending = NULL;
+    set->pending_count = 0;
+    set->pending_capacity = 0;
+    free_index(set);
+}
+
+// Number of pending pairs dropping off at level index i
+static int32_t *planned_count(stop_set *set, int i) {
+    return &set->level_index[i];
+}
+
+// First pending pair picking up at level index i in a direction, or -1
+static int32_t *chain_head(const stop_set *set, int i, int direction) {
+    return &set->level_index[(direction == DIR_UP ? 1 : 2) * set->bits.levels + i];
+}
+
+static uint32_t hash_of(const stop_set *set, int pickup, int dest) {
+    return ((uint32_t)pickup * 2654435761u ^ (uint32_t)dest * 40503u) & (uint32_t)set->hash_mask;
+}
+
+// Hash slot holding the pair (pickup, dest), or the free slot where it would go
+static uint32_t hash_slot(const stop_set *set, int pickup, int dest) {
+    uint32_t h = hash_of(set, pickup, dest);
+    while (set->hash[h]) {
+        const pending_drop *p = &set->pending[set->hash[h] - 1];
+        if (p->pickup == pickup && p->dest == dest) {
+            break;
+        }
+        h = (h + 1) & (uint32_t)set->hash_mask;
+    }
+    return h;
+}
+
+// Empty a hash slot, moving later entries of its probe run back so lookups still find them
+static void hash_delete(stop_set *set, uint32_t hole) {
+    uint32_t mask = (uint32_t)set->hash_mask;
+    set->hash[hole] = 0;
+    for (uint32_t h = (hole + 1) & mask; set->hash[h]; h = (h + 1) & mask) {
+        const pending_drop *p = &set->pending[set->hash[h] - 1];
+        uint32_t home = hash_of(set, p->pickup, p->dest);
+        if (((h - home) & mask) >= ((h - hole) & mask)) {
+            set->hash[hole] = set->hash[h];
+            set->hash[h] = 0;
+            hole = h;
+        }
+    }
+}
+
+// Grow the pending array and rehash it. Returns 0, or -1 if out of memory.
+static int grow_pending(stop_set *set) {
+    int capacity = set->pending_capacity ? set->pending_capacity * 2 : 8;
+    int32_t *hash = calloc(capacity * 2, sizeof(int32_t));
+    if (!hash) {
+        return -1;
+    }
+    pending_drop *grown = realloc(set->pending, capacity * sizeof(pending_drop));
+    if (!grown) {
+        free(hash);
+        return -1;
+    }
+    set->pending = grown;
+    set->pending_capacity = capacity;
+
+    free(set->hash);
+    set->hash = hash;
+    set->hash_mask = capacity * 2 - 1;
+    for (int i = 0; i < set->pending_count; ++i) {
+        set->hash[hash_slot(set, set->pending[i].pickup, set->pending[i].dest)] = i + 1;
+    }
+    return 0;
+}
+
+// Allocate the per-level counts and chains on first use. Returns 0, or -1 if out of memory.
+static int ensure_index(stop_set *set) {
+    if (set->level_index) {
+        return 0;
+    }
+    set->level_index = malloc(3 * set->bits.levels * sizeof(int32_t));
+    if (!set->level_index) {
+        return -1;
+    }
+    memset(set->level_index, 0, set->bits.levels * sizeof(int32_t));
+    memset(set->level_index + set->bits.levels, 0xff, 2 * set->bits.levels * sizeof(int32_t));
+    return 0;
+}
+
+// Point whatever refers to pending[i] (its chain neighbours or head, and its hash slot) at
+// index to instead
+static void relink(stop_set *set, int i, int to) {
+    pending_drop *p = &set->pending[i];
+    if (p->prev >= 0) {
+        set->pending[p->prev].next = to;
+    } else {
+        *chain_head(set, p->pickup - set->bits.lowest, p->direction) = to;
+    }
+    if (p->next >= 0) {
+        set->pending[p->next].prev = to;
+    }
+    set->hash[hash_slot(set, p->pickup, p->dest)] = to + 1;
+}
+
+// Remove pending[i] from the index and the array (the last pair moves into its place)
+static void remove_pending(stop_set *set, int i) {
+    pending_drop *p = &set->pending[i];
+    int d = p->dest - set->bits.lowest;
+
+    // Unlink from its chain and the hash
+    if (p->prev >= 0) {
+        set->pending[p->prev].next = p->next;
+    } else {
+        *chain_head(set, p->pickup - set->bits.lowest, p->direction) = p->next;
+    }
+    if (p->next >= 0) {
+        set->pending[p->next].prev = p->prev;
+    }
+    hash_delete(set, hash_slot(set, p->pickup, p->dest));
+
+    // The drop-off stays planned while another waiting passenger is going there
+    if (--*planned_count(set, d) == 0) {
+        clear_bit(set->bits.planned, d);
+    }
+
+    int last = --set->pending_count;
+    if (i != last) {
+        relink(set, last, i);
+        set->pending[i] = set->pending[last];
+    }
+}
+
+int stop_set_add_call(stop_set *set, int source, int dest) {
+    int s = source - set->bits.lowest;
+    int d = dest - set->bits.lowest;
+    if (s < 0 || s >= set->bits.levels || d < 0 || d >= set->bits.levels || s == d) {
+        return -1;
+    }
+    int direction = d > s ? DIR_UP : DIR_DOWN;
+
+    // The hall call itself is a single bit; repeated calls from the same floor merge
+    set_bit(direction == DIR_UP ? set->bits.up : set->bits.down, s);
+
+    // Remember the drop-off until the pickup is served (merging identical pairs)
+    if (ensure_index(set) != 0 ||
+        (set->pending_count == set->pending_capacity && grow_pending(set) != 0)) {
+        // Without room to defer it, make the drop-off a stop straight away
+        set_bit(set->bits.car, d);
+        return 0;
+    }
+    uint32_t h = hash_slot(set, source, dest);
+    if (set->hash[h]) {
+        set->pending[set->hash[h] - 1].callers++;
+        return 0;
+    }
+
+    int i = set->pending_count++;
+    int32_t *head = chain_head(set, s, direction);
+    pending_drop *p = &set->pending[i];
+    p->pickup = source;
+    p->direction = direction;
+    p->dest = dest;
+    p->callers = 1;
+    p->prev = -1;
+    p->next = *head;
+    if (*head >= 0) {
+        set->pending[*head].prev = i;
+    }
+    *head = i;
+    set->hash[h] = i + 1;
+
+    ++*planned_count(set, d);
+    set_bit(set->bits.planned, d);
+    return 0;
+}
+
+static int find_pending(const stop_set *set, int source, int dest) {
+    if (!set->hash) {
+        return -1;
+    }
+    int32_t entry = set->hash[hash_slot(set, source, dest)];
+    return entry - 1;
+}
+
+int stop_set_is_pending(const stop_set *set, int source, int dest) {
+    return find_pending(set, source, dest) >= 0;
+}
+
+int stop_set_remove_call(stop_set *set, int source, int dest) {
+    int i = find_pending(set, source, dest);
+    if (i < 0) {
+        return -1;
+    }
+    int direction = set->pending[i].direction;
+    if (--set->pending[i].callers > 0) {
+        return 0;
+    }
+    remove_pending(set, i);
+
+    // Only clear the hall call if nobody else is waiting to go the same way
+    int s = source - set->bits.lowest;
+    if (*chain_head(set, s, direction) < 0) {
+        clear_bit(direction == DIR_UP ? set->bits.up : set->bits.down, s);
+    }
+    return 0;
+}
+
+int stop_set_take_pending(stop_set *set, pending_drop **out) {
+    int count = set->pending_count;
+    *out = set->pending;
+    set->pending = NULL;
+    set->pending_count = 0;
+    set->pending_capacity = 0;
+    free_index(set);
+    memset(set->bits.planned, 0, sizeof(set->bits.planned));
+    return count;
+}
+
+void stop_set_arrive(stop_set *set, int level) {
+    int boarded = stop_bits_arrive(&set->bits, level, &set->direction);
+    int i = level - set->bits.lowest;
+    if (!boarded || !set->level_index || i < 0 || i >= set->bits.levels) {
+        return;
+    }
+
+    // Passengers who just boarded now need their drop-offs
+    for (int direction = DIR_DOWN; direction <= DIR_UP; direction += 2) {
+        if (!(boarded & (direction == DIR_UP ? STOPS_UP : STOPS_DOWN))) {
+            continue;
+        }
+        int32_t *head = chain_head(set, i, direction);
+        while (*head >= 0) {
+            set_bit(set->bits.car, set->pending[*head].dest - set->bits.lowest);
+            remove_pending(set, *head);
+        }
+    }
+}
+
+int stop_set_next(stop_set *set, int position) {
+    return stop_bits_next(&set->bits, position, &set->direction);
+}
+
+int stop_set_plan(const stop_set *set, int position, int *out, int max) {
+    stop_bits bits = set->bits;
+    int direction = set->direction;
+    int count = 0;
+    while (count < max) {
+        int next = stop_bits_next(&bits, position, &direction);
+        if (next == STOP_NONE) {
+            break;
+        }
+        out[count++] = next;
+        int boarded = stop_bits_arrive(&bits, next, &direction);
+        for (int d = DIR_DOWN; boarded && set->level_index && d <= DIR_UP; d += 2) {
+            if (!(boarded & (d == DIR_UP ? STOPS_UP : STOPS_DOWN))) {
+                continue;
+            }
+            for (int i = *chain_head(set, next - bits.lowest, d); i >= 0; i = set->pending[i].next) {
+                set_bit(bits.car, set->pending[i].dest - bits.lowest);
+            }
+        }
+        position = next;
+    }
+    return count;
+}
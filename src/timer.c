@@ -0,0 +1,138 @@
+// timer.c
+
+#include "timer.h"
+#include <limits.h>
+#include <stdlib.h>
+
+#define TIMER_HEAP_MIN_CAPACITY 16
+
+static void place(timer_heap *heap, size_t i, timer *t) {
+    heap->entries[i] = t;
+    t->heap_index = i;
+}
+
+// Move the timer at i towards the root while it expires before its parent
+static void sift_up(timer_heap *heap, size_t i) {
+    timer *t = heap->entries[i];
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (heap->entries[parent]->deadline_ms <= t->deadline_ms) {
+            break;
+        }
+        place(heap, i, heap->entries[parent]);
+        i = parent;
+    }
+    place(heap, i, t);
+}
+
+// Move the timer at i towards the leaves while a child expires before it
+static void sift_down(timer_heap *heap, size_t i) {
+    timer *t = heap->entries[i];
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= heap->count) {
+            break;
+        }
+        if (child + 1 < heap->count && heap->entries[child + 1]->deadline_ms < heap->entries[child]->deadline_ms) {
+            child++;
+        }
+        if (t->deadline_ms <= heap->entries[child]->deadline_ms) {
+            break;
+        }
+        place(heap, i, heap->entries[child]);
+        i = child;
+    }
+    place(heap, i, t);
+}
+
+void timer_init(timer *t, void *data) {
+    t->deadline_ms = 0;
+    t->heap_index = TIMER_IDLE;
+    t->data = data;
+}
+
+int timer_pending(const timer *t) {
+    return t->heap_index != TIMER_IDLE;
+}
+
+void timer_heap_init(timer_heap *heap) {
+    heap->entries = NULL;
+    heap->count = 0;
+    heap->capacity = 0;
+}
+
+void timer_heap_free(timer_heap *heap) {
+    free(heap->entries);
+    timer_heap_init(heap);
+}
+
+int timer_schedule(timer_heap *heap, timer *t, uint64_t deadline_ms) {
+    if (timer_pending(t)) {
+        uint64_t old = t->deadline_ms;
+        t->deadline_ms = deadline_ms;
+        if (deadline_ms < old) {
+            sift_up(heap, t->heap_index);
+        } else {
+            sift_down(heap, t->heap_index);
+        }
+        return 0;
+    }
+
+    if (heap->count == heap->capacity) {
+        size_t capacity = heap->capacity ? heap->capacity * 2 : TIMER_HEAP_MIN_CAPACITY;
+        timer **entries = realloc(heap->entries, capacity * sizeof(timer *));
+        if (!entries) {
+            return -1;
+        }
+        heap->entries = entries;
+        heap->capacity = capacity;
+    }
+    t->deadline_ms = deadline_ms;
+    place(heap, heap->count++, t);
+    sift_up(heap, t->heap_index);
+    return 0;
+}
+
+void timer_cancel(timer_heap *heap, timer *t) {
+    if (!timer_pending(t)) {
+        return;
+    }
+    size_t i = t->heap_index;
+    timer *last = heap->entries[--heap->count];
+    t->heap_index = TIMER_IDLE;
+    if (last == t) {
+        return;  // It was the last entry
+    }
+
+    // Fill the hole with the last entry, which may belong above or below it
+    place(heap, i, last);
+    if (i > 0 && heap->entries[(i - 1) / 2]->deadline_ms > last->deadline_ms) {
+        sift_up(heap, i);
+    } else {
+        sift_down(heap, i);
+    }
+}
+
+uint64_t timer_next_deadline(const timer_heap *heap) {
+    return heap->count ? heap->entries[0]->deadline_ms : 0;
+}
+
+timer *timer_pop_expired(timer_heap *heap, uint64_t now) {
+    if (heap->count == 0 || heap->entries[0]->deadline_ms > now) {
+        return NULL;
+    }
+    timer *t = heap->entries[0];
+    timer_cancel(heap, t);
+    return t;
+}
+
+int timer_timeout_ms(const timer_heap *heap, uint64_t now) {
+    if (heap->count == 0) {
+        return -1;
+    }
+    uint64_t deadline = heap->entries[0]->deadline_ms;
+    if (deadline <= now) {
+        return 0;
+    }
+    return deadline - now > INT_MAX ? INT_MAX : (int)(deadline - now);
+}
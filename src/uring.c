@@ -0,0 +1,222 @@
+// uring.c
+
+#include "uring.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int sys_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t arg_size) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(uring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+
+    // Completions are only reaped when the loop asks for them, so deferred task work is fine
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_COOP_TASKRUN;
+    int fd = sys_setup(entries, &params);
+    if (fd < 0 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));
+        fd = sys_setup(entries, &params);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+
+    // One mapping for both rings, and timed waits through io_uring_enter()
+    unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG;
+    if ((params.features & required) != required) {
+        close(fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->ring_mem = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->ring_mem == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        munmap(ring->ring_mem, ring->ring_size);
+        close(fd);
+        return -1;
+    }
+
+    unsigned char *mem = ring->ring_mem;
+    ring->fd = fd;
+    ring->sq_head = (unsigned *)(mem + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(mem + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(mem + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_array = (unsigned *)(mem + params.sq_off.array);
+    ring->cq_head = (unsigned *)(mem + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(mem + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(mem + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(mem + params.cq_off.cqes);
+
+    // Ring slot i always holds sqe i
+    for (unsigned i = 0; i < ring->sq_entries; ++i) {
+        ring->sq_array[i] = i;
+    }
+    return 0;
+}
+
+void uring_free(uring *ring) {
+    if (ring->fd < 0) {
+        return;
+    }
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->ring_mem, ring->ring_size);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(uring *ring) {
+    unsigned tail = *ring->sq_tail;
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        // Full: hand the queued entries to the kernel to make room
+        if (uring_submit_and_wait(ring, 0) < 0 ||
+            tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+
+    // The kernel only reads entries during io_uring_enter(), so the tail can move now
+    struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->sq_pending++;
+    return sqe;
+}
+
+int uring_submit_and_wait(uring *ring, int timeout_ms) {
+    unsigned flags = 0;
+    unsigned min_complete = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    void *arg_ptr = NULL;
+    size_t arg_size = 0;
+
+    if (timeout_ms != 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        min_complete = 1;
+    }
+    if (timeout_ms > 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        arg_ptr = &arg;
+        arg_size = sizeof(arg);
+    }
+    if (ring->sq_pending == 0 && min_complete == 0) {
+        return 0;
+    }
+
+    int submitted = sys_enter(ring->fd, ring->sq_pending, min_complete, flags, arg_ptr, arg_size);
+    if (submitted < 0) {
+        // A timeout or signal just ends the wait early
+        return (errno == ETIME || errno == EINTR) ? 0 : -errno;
+    }
+    ring->sq_pending -= (unsigned)submitted < ring->sq_pending ? (unsigned)submitted : ring->sq_pending;
+    return 0;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(uring *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_buffers_init(uring *ring, uring_buffers *bufs, uint16_t group, unsigned entries, size_t buf_size) {
+    memset(bufs, 0, sizeof(*bufs));
+    bufs->entries = entries;
+    bufs->group = group;
+    bufs->buf_size = buf_size;
+
+    // The descriptor ring must be page aligned; mmap() provides that
+    size_t ring_bytes = entries * sizeof(struct io_uring_buf);
+    bufs->ring = mmap(NULL, ring_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufs->ring == MAP_FAILED) {
+        bufs->ring = NULL;
+        return -1;
+    }
+    bufs->memory = mmap(NULL, entries * buf_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufs->memory == MAP_FAILED) {
+        munmap(bufs->ring, ring_bytes);
+        bufs->ring = NULL;
+        bufs->memory = NULL;
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)bufs->ring;
+    reg.ring_entries = entries;
+    reg.bgid = group;
+    if (sys_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        munmap(bufs->memory, entries * buf_size);
+        munmap(bufs->ring, ring_bytes);
+        bufs->ring = NULL;
+        bufs->memory = NULL;
+        return -1;
+    }
+
+    // Hand every buffer to the kernel
+    for (unsigned i = 0; i < entries; ++i) {
+        uring_buffer_recycle(bufs, i);
+    }
+    return 0;
+}
+
+void uring_buffers_free(uring *ring, uring_buffers *bufs) {
+    if (!bufs->ring) {
+        return;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = bufs->group;
+    sys_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(bufs->memory, bufs->entries * bufs->buf_size);
+    munmap(bufs->ring, bufs->entries * sizeof(struct io_uring_buf));
+    bufs->ring = NULL;
+    bufs->memory = NULL;
+}
+
+void *uring_buffer(uring_buffers *bufs, unsigned id) {
+    return bufs->memory + (size_t)id * bufs->buf_size;
+}
+
+void uring_buffer_recycle(uring_buffers *bufs, unsigned id) {
+    uint16_t tail = bufs->ring->tail;
+    struct io_uring_buf *buf = &bufs->ring->bufs[tail & (bufs->entries - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buffer(bufs, id);
+    buf->len = (uint32_t)bufs->buf_size;
+    buf->bid = (uint16_t)id;
+    __atomic_store_n(&bufs->ring->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
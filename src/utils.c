@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <unistd.h>
 #include <signal.h>
 #include <time.h>
@@ -65,7 +66,26 @@ int is_valid_status(const char *status) {
 }
 
 void sleep_ms(int milliseconds) {
-    usleep(milliseconds * 1000);
+    sleep_until_ms(monotonic_ms() + (milliseconds > 0 ? milliseconds : 0));
+}
+
+void sleep_until_ms(uint64_t deadline_ms) {
+    struct timespec deadline;
+    ms_to_timespec(deadline_ms, &deadline);
+    // An absolute deadline can simply be retried when a signal interrupts the sleep
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+}
+
+uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+void ms_to_timespec(uint64_t ms, struct timespec *ts) {
+    ts->tv_sec = (time_t)(ms / 1000);
+    ts->tv_nsec = (long)(ms % 1000) * 1000000;
 }
 
 void setup_signal_handler(void (*handler)(int)) {
@@ -98,6 +118,15 @@ void int_to_floor(int floor_int, char *floor_str) {
     }
 }
 
+int floor_to_level(const char *floor) {
+    int f = floor_to_int(floor);
+    return f > 0 ? f - 1 : f;
+}
+
+void level_to_floor(int level, char *floor_str) {
+    int_to_floor(level >= 0 ? level + 1 : level, floor_str);
+}
+
 int compare_floors(const char *floor1, const char *floor2) {
     int f1 = floor_to_int(floor1);
     int f2 = floor_to_int(floor2);
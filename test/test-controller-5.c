@@ -0,0 +1,123 @@
+#include "shared.h"
+
+// Tester for controller (single car, repeated calls share one stop and calls that go
+// nowhere are refused)
+
+#define DELAY 50000 // 50ms
+#define MILLISECOND 1000 // 1ms
+
+pid_t controller(void);
+int connect_to_controller(void);
+void test_call(const char *, const char *);
+void test_recv(int, const char *);
+void cleanup(pid_t);
+
+int main()
+{
+  pid_t p;
+  p = controller();
+  usleep(DELAY);
+
+  int alpha = connect_to_controller();
+  send_message(alpha, "CAR Alpha 1 9");
+  send_message(alpha, "STATUS Closed 1 1");
+  usleep(DELAY);
+
+  // A call to the floor the caller is already on cannot be served
+  test_call("CALL 3 3", "UNAVAILABLE");
+
+  test_call("CALL 3 6", "CAR Alpha");
+  test_recv(alpha, "RECV: FLOOR 3");
+  // The same call again merges into the stop already planned
+  test_call("CALL 3 6", "CAR Alpha");
+  test_call("CALL 4 6", "CAR Alpha");
+  // Queue should be: 3 4 6, with 3 and 6 visited once for both callers
+
+  send_message(alpha, "STATUS Between 1 3");
+  send_message(alpha, "STATUS Between 2 3");
+  send_message(alpha, "STATUS Opening 3 3");
+  test_recv(alpha, "RECV: FLOOR 4");
+  send_message(alpha, "STATUS Open 3 4");
+  send_message(alpha, "STATUS Closing 3 4");
+  send_message(alpha, "STATUS Between 3 4");
+  send_message(alpha, "STATUS Opening 4 4");
+  test_recv(alpha, "RECV: FLOOR 6");
+  send_message(alpha, "STATUS Open 4 6");
+  send_message(alpha, "STATUS Closing 4 6");
+  send_message(alpha, "STATUS Between 4 6");
+  send_message(alpha, "STATUS Between 5 6");
+  send_message(alpha, "STATUS Opening 6 6");
+  send_message(alpha, "STATUS Open 6 6");
+  send_message(alpha, "STATUS Closing 6 6");
+  send_message(alpha, "STATUS Closed 6 6");
+  usleep(DELAY);
+
+  // Nothing is left, so the next call is the next stop
+  test_call("CALL 2 1", "CAR Alpha");
+  test_recv(alpha, "RECV: FLOOR 2");
+
+  // Tagged calls get their request ID back, refused or not, on the same connection
+  int session = connect_to_controller();
+  send_message(session, "CALL 5 3 3");
+  test_recv(session, "RECV: UNAVAILABLE 5");
+  send_message(session, "CALL 6 1 2");
+  test_recv(session, "RECV: CAR 6 Alpha");
+  close(session);
+
+  cleanup(p);
+
+  close(alpha);
+
+  printf("\nTests completed.\n");
+}
+
+void test_call(const char *sendmsg, const char *expectedreply)
+{
+  int fd = connect_to_controller();
+  send_message(fd, sendmsg);
+  char *reply = receive_msg(fd);
+  msg(expectedreply);
+  printf("%s\n", reply);
+  free(reply);
+  close(fd);
+}
+
+void test_recv(int fd, const char *t)
+{
+  char *m = receive_msg(fd);
+  msg(t);
+  printf("RECV: %s\n", m);
+  free(m);
+}
+
+int connect_to_controller(void)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sockaddr;
+  memset(&sockaddr, 0, sizeof(sockaddr));
+  sockaddr.sin_family = AF_INET;
+  sockaddr.sin_port = htons(3000);
+  sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (const struct sockaddr *)&sockaddr, sizeof(sockaddr)) == -1)
+  {
+    perror("connect()");
+    exit(1);
+  }
+  return fd;
+}
+
+void cleanup(pid_t p)
+{
+  // Terminate with SIGINT to allow server to clean up
+  kill(p, SIGINT);
+}
+
+pid_t controller(void)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("/home/c/Projects/major-project/controller", "/home/c/Projects/major-project/controller", NULL);
+  }
+
+  return pid;
+}
@@ -0,0 +1,140 @@
+#include "shared.h"
+
+// Tester for controller (batch assignment and reassignment of session calls)
+
+/*
+    The controller collects calls for 50ms and assigns each batch together. A session call
+    stays open until its pickup is served and moves to another car if that car would reach
+    the caller more than a door cycle sooner.
+*/
+
+#define DELAY 50000 // 50ms
+#define MILLISECOND 1000 // 1ms
+
+pid_t controller(void);
+int connect_to_controller(void);
+void test_call(const char *, const char *);
+void test_recv(int, const char *);
+void cleanup(pid_t);
+
+int main()
+{
+  pid_t p;
+  p = controller();
+  usleep(DELAY);
+
+  int alpha = connect_to_controller();
+  send_message(alpha, "CAR Alpha 1 20");
+  send_message(alpha, "STATUS Closed 1 1");
+
+  int beta = connect_to_controller();
+  send_message(beta, "CAR Beta 1 20");
+  send_message(beta, "STATUS Closed 20 20");
+  usleep(DELAY);
+
+  // Two calls in one batch go to the car nearest each of them
+  int first = connect_to_controller();
+  int second = connect_to_controller();
+  send_message(first, "CALL 2 3");
+  send_message(second, "CALL 19 18");
+  test_recv(first, "RECV: CAR Alpha");
+  test_recv(second, "RECV: CAR Beta");
+  test_recv(alpha, "RECV: FLOOR 2");
+  test_recv(beta, "RECV: FLOOR 19");
+  close(first);
+  close(second);
+
+  send_message(alpha, "STATUS Between 1 2");
+  send_message(alpha, "STATUS Opening 2 2");
+  test_recv(alpha, "RECV: FLOOR 3");
+  send_message(alpha, "STATUS Open 2 3");
+  send_message(alpha, "STATUS Closing 2 3");
+  send_message(alpha, "STATUS Between 2 3");
+  send_message(alpha, "STATUS Opening 3 3");
+  send_message(alpha, "STATUS Open 3 3");
+  send_message(alpha, "STATUS Closing 3 3");
+  send_message(alpha, "STATUS Closed 3 3");
+
+  send_message(beta, "STATUS Opening 19 19");
+  test_recv(beta, "RECV: FLOOR 18");
+  send_message(beta, "STATUS Open 19 18");
+  send_message(beta, "STATUS Closing 19 18");
+  send_message(beta, "STATUS Between 19 18");
+  send_message(beta, "STATUS Opening 18 18");
+  send_message(beta, "STATUS Open 18 18");
+  send_message(beta, "STATUS Closing 18 18");
+  send_message(beta, "STATUS Closed 18 18");
+  usleep(DELAY);
+
+  // A session call goes to Alpha, the nearer car
+  int session = connect_to_controller();
+  send_message(session, "CALL 1 8 12");
+  test_recv(session, "RECV: CAR 1 Alpha");
+  test_recv(alpha, "RECV: FLOOR 8");
+
+  // Beta is now next to the caller, so the next batch moves the call to it
+  send_message(beta, "STATUS Closed 9 9");
+  usleep(DELAY);
+  test_call("CALL 3 4", "CAR Alpha");
+  test_recv(session, "RECV: CAR 1 Beta");
+  test_recv(beta, "RECV: FLOOR 8");
+  close(session);
+
+  cleanup(p);
+
+  close(alpha);
+  close(beta);
+
+  printf("\nTests completed.\n");
+}
+
+void test_call(const char *sendmsg, const char *expectedreply)
+{
+  int fd = connect_to_controller();
+  send_message(fd, sendmsg);
+  char *reply = receive_msg(fd);
+  msg(expectedreply);
+  printf("%s\n", reply);
+  free(reply);
+  close(fd);
+}
+
+void test_recv(int fd, const char *t)
+{
+  char *m = receive_msg(fd);
+  msg(t);
+  printf("RECV: %s\n", m);
+  free(m);
+}
+
+int connect_to_controller(void)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sockaddr;
+  memset(&sockaddr, 0, sizeof(sockaddr));
+  sockaddr.sin_family = AF_INET;
+  sockaddr.sin_port = htons(3000);
+  sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (const struct sockaddr *)&sockaddr, sizeof(sockaddr)) == -1)
+  {
+    perror("connect()");
+    exit(1);
+  }
+  return fd;
+}
+
+void cleanup(pid_t p)
+{
+  // Terminate with SIGINT to allow server to clean up
+  kill(p, SIGINT);
+}
+
+pid_t controller(void)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("/home/c/Projects/major-project/controller", "/home/c/Projects/major-project/controller", "--batch-ms", "50", "--reassign", NULL);
+  }
+
+  return pid;
+}
@@ -0,0 +1,107 @@
+#include "shared.h"
+
+// Tester for controller (itinerary cars: the controller pushes the car's planned stops in
+// order and the car works through them without being sent each floor)
+
+#define DELAY 50000 // 50ms
+#define MILLISECOND 1000 // 1ms
+
+pid_t controller(void);
+int connect_to_controller(void);
+void test_call(const char *, const char *);
+void test_recv(int, const char *);
+void cleanup(pid_t);
+
+int main()
+{
+  pid_t p;
+  p = controller();
+  usleep(DELAY);
+
+  int alpha = connect_to_controller();
+  send_message(alpha, "CAR Alpha 1 9 ITINERARY");
+  send_message(alpha, "STATUS Closed 1 1");
+  usleep(DELAY);
+
+  // Each call that changes the plan sends the whole itinerary again, with a new version
+  test_call("CALL 3 6", "CAR Alpha");
+  test_recv(alpha, "RECV: ITINERARY 1 3 6");
+  test_call("CALL 4 5", "CAR Alpha");
+  test_recv(alpha, "RECV: ITINERARY 2 3 4 5 6");
+  // The drop-off at 2 follows the pickup at 7, after the sweep up
+  test_call("CALL 7 2", "CAR Alpha");
+  test_recv(alpha, "RECV: ITINERARY 3 3 4 5 6 7 2");
+
+  // Reaching the stops it was given needs no further messages
+  send_message(alpha, "STATUS Between 1 3");
+  send_message(alpha, "STATUS Between 2 3");
+  send_message(alpha, "STATUS Opening 3 3");
+  send_message(alpha, "STATUS Open 3 4");
+  send_message(alpha, "STATUS Closing 3 4");
+  send_message(alpha, "STATUS Between 3 4");
+  send_message(alpha, "STATUS Opening 4 4");
+  send_message(alpha, "STATUS Open 4 5");
+  send_message(alpha, "STATUS Closing 4 5");
+  usleep(DELAY);
+
+  // So the next itinerary is version 4, holding only the stops still ahead
+  test_call("CALL 8 9", "CAR Alpha");
+  test_recv(alpha, "RECV: ITINERARY 4 5 6 8 9 7 2");
+
+  cleanup(p);
+
+  close(alpha);
+
+  printf("\nTests completed.\n");
+}
+
+void test_call(const char *sendmsg, const char *expectedreply)
+{
+  int fd = connect_to_controller();
+  send_message(fd, sendmsg);
+  char *reply = receive_msg(fd);
+  msg(expectedreply);
+  printf("%s\n", reply);
+  free(reply);
+  close(fd);
+}
+
+void test_recv(int fd, const char *t)
+{
+  char *m = receive_msg(fd);
+  msg(t);
+  printf("RECV: %s\n", m);
+  free(m);
+}
+
+int connect_to_controller(void)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sockaddr;
+  memset(&sockaddr, 0, sizeof(sockaddr));
+  sockaddr.sin_family = AF_INET;
+  sockaddr.sin_port = htons(3000);
+  sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (const struct sockaddr *)&sockaddr, sizeof(sockaddr)) == -1)
+  {
+    perror("connect()");
+    exit(1);
+  }
+  return fd;
+}
+
+void cleanup(pid_t p)
+{
+  // Terminate with SIGINT to allow server to clean up
+  kill(p, SIGINT);
+}
+
+pid_t controller(void)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("/home/c/Projects/major-project/controller", "/home/c/Projects/major-project/controller", NULL);
+  }
+
+  return pid;
+}
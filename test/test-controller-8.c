@@ -0,0 +1,100 @@
+#include "shared.h"
+
+// Tester for controller (cars with a motion profile are timed by it when choosing a car)
+
+/*
+    Alpha has no profile, so every floor takes its delay (100ms until observed).
+    Beta announces "MOTION 20 200": one floor every 20ms once it has spent 200ms
+    accelerating, so a long run is much faster than Alpha's even from further away.
+*/
+
+#define DELAY 50000 // 50ms
+#define MILLISECOND 1000 // 1ms
+
+pid_t controller(void);
+int connect_to_controller(void);
+void test_call(const char *, const char *);
+void test_recv(int, const char *);
+void cleanup(pid_t);
+
+int main()
+{
+  pid_t p;
+  p = controller();
+  usleep(DELAY);
+
+  int alpha = connect_to_controller();
+  send_message(alpha, "CAR Alpha 1 40");
+  send_message(alpha, "STATUS Closed 5 5");
+
+  int beta = connect_to_controller();
+  send_message(beta, "CAR Beta 1 40 MOTION 20 200");
+  send_message(beta, "STATUS Closed 1 1");
+  usleep(DELAY);
+
+  // Alpha is 25 floors away (2500ms), Beta 29 floors away (29 * 20 + 200 = 780ms)
+  test_call("CALL 30 31", "CAR Beta");
+  test_recv(beta, "RECV: FLOOR 30");
+
+  // One floor away, Alpha's 100ms beats Beta, which is also busy
+  test_call("CALL 6 7", "CAR Alpha");
+  test_recv(alpha, "RECV: FLOOR 6");
+
+  cleanup(p);
+
+  close(alpha);
+  close(beta);
+
+  printf("\nTests completed.\n");
+}
+
+void test_call(const char *sendmsg, const char *expectedreply)
+{
+  int fd = connect_to_controller();
+  send_message(fd, sendmsg);
+  char *reply = receive_msg(fd);
+  msg(expectedreply);
+  printf("%s\n", reply);
+  free(reply);
+  close(fd);
+}
+
+void test_recv(int fd, const char *t)
+{
+  char *m = receive_msg(fd);
+  msg(t);
+  printf("RECV: %s\n", m);
+  free(m);
+}
+
+int connect_to_controller(void)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sockaddr;
+  memset(&sockaddr, 0, sizeof(sockaddr));
+  sockaddr.sin_family = AF_INET;
+  sockaddr.sin_port = htons(3000);
+  sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (const struct sockaddr *)&sockaddr, sizeof(sockaddr)) == -1)
+  {
+    perror("connect()");
+    exit(1);
+  }
+  return fd;
+}
+
+void cleanup(pid_t p)
+{
+  // Terminate with SIGINT to allow server to clean up
+  kill(p, SIGINT);
+}
+
+pid_t controller(void)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("/home/c/Projects/major-project/controller", "/home/c/Projects/major-project/controller", NULL);
+  }
+
+  return pid;
+}
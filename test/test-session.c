@@ -0,0 +1,119 @@
+#include "shared.h"
+#include <sys/wait.h>
+
+// Tester for call sessions (call --session) against the controller: more calls than a
+// session can have in flight at once are piped through one session, which must answer
+// every one of them and exit once its input ends
+
+#define DELAY 50000 // 50ms
+#define CALLS 1500  // More than the 1024 calls a session keeps in flight
+#define TIMEOUT 10  // Seconds the session may take
+
+pid_t controller(void);
+int connect_to_controller(void);
+void cleanup(pid_t);
+
+int main()
+{
+  pid_t p;
+  p = controller();
+  usleep(DELAY);
+
+  // Register a car that can take floors 1 to 4
+  int alpha = connect_to_controller();
+  send_message(alpha, "CAR Alpha 1 4");
+  send_message(alpha, "STATUS Closed 1 1");
+  usleep(DELAY);
+
+  // Write the calls to a file and run the session with it as input
+  char input[] = "/tmp/test-session-in-XXXXXX";
+  char output[] = "/tmp/test-session-out-XXXXXX";
+  int in = mkstemp(input);
+  int out = mkstemp(output);
+  FILE *f = fdopen(in, "w");
+  for (int i = 0; i < CALLS; i++) {
+    fprintf(f, "%d %d\n", i % 4 + 1, (i + 1) % 4 + 1);
+  }
+  fclose(f);
+
+  pid_t session = fork();
+  if (session == 0) {
+    int fd = open(input, O_RDONLY);
+    dup2(fd, STDIN_FILENO);
+    dup2(out, STDOUT_FILENO);
+    execlp("/home/c/Projects/major-project/call", "call", "--session", NULL);
+    exit(1);
+  }
+
+  // The session must exit by itself once every call has been answered
+  int status;
+  int exited = 0;
+  for (int waited = 0; waited < TIMEOUT * 100 && !exited; waited++) {
+    if (waitpid(session, &status, WNOHANG) == session) {
+      exited = 1;
+    } else {
+      usleep(10000);
+    }
+  }
+  if (!exited) {
+    kill(session, SIGKILL);
+    waitpid(session, &status, 0);
+  }
+  msg("Session exited");
+  printf("%s\n", exited && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "Session exited" : "Session hung");
+
+  // Every call is answered exactly once, by the only car that can take it
+  FILE *results = fopen(output, "r");
+  char line[256];
+  int answered = 0, other = 0;
+  while (fgets(line, sizeof(line), results)) {
+    if (strstr(line, "Car Alpha is arriving.")) {
+      answered++;
+    } else {
+      other++;
+    }
+  }
+  fclose(results);
+  msg("1500 calls answered, 0 other lines");
+  printf("%d calls answered, %d other lines\n", answered, other);
+
+  cleanup(p);
+  close(alpha);
+  close(out);
+  unlink(input);
+  unlink(output);
+
+  printf("\nTests completed.\n");
+}
+
+int connect_to_controller(void)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sockaddr;
+  memset(&sockaddr, 0, sizeof(sockaddr));
+  sockaddr.sin_family = AF_INET;
+  sockaddr.sin_port = htons(3000);
+  sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (const struct sockaddr *)&sockaddr, sizeof(sockaddr)) == -1)
+  {
+    perror("connect()");
+    exit(1);
+  }
+  return fd;
+}
+
+void cleanup(pid_t p)
+{
+  // Terminate with SIGINT to allow server to clean up
+  kill(p, SIGINT);
+}
+
+pid_t controller(void)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    execlp("/home/c/Projects/major-project/controller", "/home/c/Projects/major-project/controller", NULL);
+  }
+
+  return pid;
+}